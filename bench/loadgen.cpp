@@ -0,0 +1,278 @@
+// Load generator for a running vivarium_cpp_process.
+//
+//   vivarium_loadgen [--host H] [--port P | --socket PATH]
+//                    [--connections N] [--requests N] [--pipeline N]
+//                    [--mix update=8,update_batch=1,inputs=1] [--batch N]
+//
+// Opens N connections, each on its own thread, and sends --requests
+// requests on each with up to --pipeline of them outstanding. The
+// command of every request is drawn from --mix by weight. Prints the
+// overall throughput and p50/p99/p999 latency per command, measured
+// from sending a request to reading its reply.
+
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "line_reader.hpp"
+#include "net.hpp"
+#include "process.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+static const size_t MAX_REPLY_BYTES = 256 * 1024 * 1024;
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 11111;
+    std::string socket_path;
+    size_t connections = 4;
+    size_t requests = 10000;  // per connection
+    size_t pipeline = 1;
+    size_t batch = 64;
+    std::string mix = "update=1";
+};
+
+struct Kind {
+    std::string name;
+    unsigned weight;
+    std::string line;  // the request, newline included
+};
+
+struct Samples {
+    std::vector<std::vector<uint64_t>> latency_ns;  // per kind
+    size_t errors = 0;
+    bool failed = false;
+};
+
+static void usage() {
+    std::fprintf(stderr,
+                 "usage: vivarium_loadgen [--host H] [--port P | --socket PATH] [--connections N]\n"
+                 "                        [--requests N] [--pipeline N] [--mix cmd=w,...] [--batch N]\n"
+                 "commands: update, update_batch, inputs, outputs\n");
+}
+
+static std::string request_line(const std::string& name, size_t batch) {
+    json cmd;
+    if (name == "update") {
+        cmd = json{{"command", "update"}, {"arguments", {{"state", {{"counter", 1.0}}}, {"interval", 0.5}}}};
+    } else if (name == "update_batch") {
+        json entries = json::array();
+        for (size_t i = 0; i < batch; ++i) {
+            entries.push_back(json{{"state", {{"counter", static_cast<double>(i)}}}, {"interval", 0.5}});
+        }
+        cmd = json{{"command", "update_batch"}, {"arguments", {{"entries", entries}}}};
+    } else if (name == "inputs" || name == "outputs") {
+        cmd = json{{"command", name}};
+    } else {
+        return std::string();
+    }
+    return cmd.dump() + "\n";
+}
+
+// "update=8,update_batch=1" -> kinds with their weights.
+static bool parse_mix(const Options& opts, std::vector<Kind>& kinds) {
+    std::stringstream in(opts.mix);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        size_t eq = item.find('=');
+        std::string name = item.substr(0, eq);
+        unsigned weight = eq == std::string::npos ? 1 : static_cast<unsigned>(std::atoi(item.c_str() + eq + 1));
+        std::string line = request_line(name, opts.batch);
+        if (line.empty()) {
+            std::fprintf(stderr, "unknown command in --mix: %s\n", name.c_str());
+            return false;
+        }
+        if (weight > 0) kinds.push_back(Kind{name, weight, line});
+    }
+    return !kinds.empty();
+}
+
+static int connect_to(const Options& opts) {
+    if (!opts.socket_path.empty()) {
+        int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, opts.socket_path.c_str(), sizeof(addr.sun_path) - 1);
+        if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+            perror("connect");
+            if (fd >= 0) ::close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(opts.port));
+    if (fd < 0 || ::inet_pton(AF_INET, opts.host.c_str(), &addr.sin_addr) <= 0 ||
+        ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        perror("connect");
+        if (fd >= 0) ::close(fd);
+        return -1;
+    }
+    int one = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+static bool send_all(int fd, const std::string& data) {
+    size_t off = 0;
+    while (off < data.size()) {
+        ssize_t n = ::send(fd, data.data() + off, data.size() - off, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        off += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+static void drive(const Options& opts, const std::vector<Kind>& kinds, unsigned seed, Samples& out) {
+    out.latency_ns.assign(kinds.size(), {});
+    int fd = connect_to(opts);
+    if (fd < 0) {
+        out.failed = true;
+        return;
+    }
+
+    std::vector<unsigned> weights;
+    for (const Kind& k : kinds) weights.push_back(k.weight);
+    std::mt19937 rng(seed);
+    std::discrete_distribution<size_t> pick(weights.begin(), weights.end());
+
+    struct Outstanding {
+        size_t kind;
+        Clock::time_point sent;
+    };
+    std::deque<Outstanding> outstanding;
+    LineReader reader(MAX_REPLY_BYTES);
+    std::string burst;
+    size_t sent = 0;
+    size_t received = 0;
+
+    while (received < opts.requests) {
+        // Top the pipeline up in one write.
+        burst.clear();
+        Clock::time_point now = Clock::now();
+        while (sent < opts.requests && outstanding.size() < opts.pipeline) {
+            size_t k = pick(rng);
+            burst += kinds[k].line;
+            outstanding.push_back(Outstanding{k, now});
+            ++sent;
+        }
+        if (!burst.empty() && !send_all(fd, burst)) {
+            perror("send");
+            out.failed = true;
+            break;
+        }
+
+        auto reply = recv_line(fd, reader);
+        if (!reply) {
+            std::fprintf(stderr, "connection closed after %zu replies\n", received);
+            out.failed = true;
+            break;
+        }
+        Outstanding o = outstanding.front();
+        outstanding.pop_front();
+        uint64_t ns = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - o.sent).count());
+        out.latency_ns[o.kind].push_back(ns);
+        if (reply->compare(0, 9, "{\"error\":") == 0) ++out.errors;
+        ++received;
+    }
+    ::close(fd);
+}
+
+static double percentile_us(const std::vector<uint64_t>& sorted, double q) {
+    if (sorted.empty()) return 0.0;
+    size_t i = static_cast<size_t>(q * static_cast<double>(sorted.size() - 1));
+    return static_cast<double>(sorted[i]) / 1000.0;
+}
+
+int main(int argc, char** argv) {
+    Options opts;
+    static const option long_options[] = {
+        {"host", required_argument, nullptr, 'H'},
+        {"port", required_argument, nullptr, 'P'},
+        {"socket", required_argument, nullptr, 'S'},
+        {"connections", required_argument, nullptr, 'c'},
+        {"requests", required_argument, nullptr, 'n'},
+        {"pipeline", required_argument, nullptr, 'p'},
+        {"mix", required_argument, nullptr, 'm'},
+        {"batch", required_argument, nullptr, 'b'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+    int c;
+    while ((c = ::getopt_long(argc, argv, "H:P:S:c:n:p:m:b:h", long_options, nullptr)) != -1) {
+        switch (c) {
+        case 'H': opts.host = optarg; break;
+        case 'P': opts.port = std::atoi(optarg); break;
+        case 'S': opts.socket_path = optarg; break;
+        case 'c': opts.connections = std::max(1L, std::atol(optarg)); break;
+        case 'n': opts.requests = std::max(1L, std::atol(optarg)); break;
+        case 'p': opts.pipeline = std::max(1L, std::atol(optarg)); break;
+        case 'm': opts.mix = optarg; break;
+        case 'b': opts.batch = std::max(1L, std::atol(optarg)); break;
+        default:
+            usage();
+            return c == 'h' ? 0 : 2;
+        }
+    }
+
+    std::vector<Kind> kinds;
+    if (!parse_mix(opts, kinds)) {
+        usage();
+        return 2;
+    }
+
+    std::vector<Samples> samples(opts.connections);
+    std::vector<std::thread> threads;
+    auto start = Clock::now();
+    for (size_t i = 0; i < opts.connections; ++i) {
+        threads.emplace_back([&, i] { drive(opts, kinds, static_cast<unsigned>(i + 1), samples[i]); });
+    }
+    for (auto& t : threads) t.join();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    size_t total = 0;
+    size_t errors = 0;
+    bool failed = false;
+    std::printf("%-14s %10s %10s %10s %10s %10s\n", "command", "count", "p50_us", "p99_us", "p999_us", "max_us");
+    for (size_t k = 0; k < kinds.size(); ++k) {
+        std::vector<uint64_t> all;
+        for (const Samples& s : samples) {
+            if (k < s.latency_ns.size()) all.insert(all.end(), s.latency_ns[k].begin(), s.latency_ns[k].end());
+        }
+        std::sort(all.begin(), all.end());
+        total += all.size();
+        std::printf("%-14s %10zu %10.1f %10.1f %10.1f %10.1f\n", kinds[k].name.c_str(), all.size(),
+                    percentile_us(all, 0.50), percentile_us(all, 0.99), percentile_us(all, 0.999),
+                    all.empty() ? 0.0 : static_cast<double>(all.back()) / 1000.0);
+    }
+    for (const Samples& s : samples) {
+        errors += s.errors;
+        failed = failed || s.failed;
+    }
+    std::printf("%zu requests over %zu connections in %.3f s: %.0f req/s, %zu errors\n", total,
+                opts.connections, seconds, static_cast<double>(total) / seconds, errors);
+    return failed ? 1 : 0;
+}
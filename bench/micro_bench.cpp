@@ -0,0 +1,257 @@
+// Micro-benchmarks for the request hot path.
+//
+//   vivarium_bench [filter]
+//
+// Runs every benchmark whose name contains `filter` and prints the time
+// per item and items per second. Each one is repeated until it has run
+// for at least MIN_SECONDS, after a short warm-up.
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "counter_process.hpp"
+#include "fast_update.hpp"
+#include "framing.hpp"
+#include "line_reader.hpp"
+#include "net.hpp"
+#include "protocol.hpp"
+#include "result_cache.hpp"
+
+static const double MIN_SECONDS = 0.25;
+static const int WARMUP_CALLS = 16;
+static const size_t LINES_PER_FILL = 256;  // recv_line: lines written to the socket per call
+static const size_t BATCH_ENTRIES = 256;
+static const size_t WIDE_STATE_FIELDS = 1000;
+static const size_t COLUMN_ROWS = 100000;
+
+static std::string FILTER;
+
+// Keeps the compiler from optimizing `value` away.
+template <class T>
+static void keep(T const& value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+// `body` processes `items` items per call.
+template <class F>
+static void bench(const char* name, size_t items, F&& body) {
+    if (!FILTER.empty() && std::strstr(name, FILTER.c_str()) == nullptr) return;
+
+    for (int i = 0; i < WARMUP_CALLS; ++i) body();
+
+    using clock = std::chrono::steady_clock;
+    size_t calls = 1;
+    double seconds = 0.0;
+    while (true) {
+        auto start = clock::now();
+        for (size_t i = 0; i < calls; ++i) body();
+        seconds = std::chrono::duration<double>(clock::now() - start).count();
+        if (seconds >= MIN_SECONDS) break;
+        calls *= 2;
+    }
+    double per_item = seconds / static_cast<double>(calls * items);
+    std::printf("%-36s %12.1f ns/item %14.0f items/s\n", name, per_item * 1e9, 1.0 / per_item);
+}
+
+static json update_command(const json& state) {
+    return json{{"command", "update"}, {"arguments", {{"state", state}, {"interval", 0.5}}}};
+}
+
+static json wide_state() {
+    json state = json::object();
+    for (size_t i = 0; i < WIDE_STATE_FIELDS; ++i) {
+        state["field_" + std::to_string(i)] = static_cast<double>(i) * 0.25;
+    }
+    state["counter"] = 1.0;
+    return state;
+}
+
+// ---- Transport ----
+
+static void bench_recv_line() {
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        perror("socketpair");
+        return;
+    }
+    std::string chunk;
+    std::string line = update_command(json{{"counter", 1.0}}).dump();
+    for (size_t i = 0; i < LINES_PER_FILL; ++i) chunk += line + "\n";
+
+    LineReader reader(1024 * 1024);
+    bench("recv_line", LINES_PER_FILL, [&] {
+        ssize_t ignored = ::write(fds[0], chunk.data(), chunk.size());
+        (void)ignored;
+        for (size_t i = 0; i < LINES_PER_FILL; ++i) keep(recv_line(fds[1], reader));
+    });
+    ::close(fds[0]);
+    ::close(fds[1]);
+}
+
+// ---- Codecs ----
+
+static void bench_codecs() {
+    const struct {
+        const char* label;
+        json value;
+    } payloads[] = {
+        {"small", update_command(json{{"counter", 1.0}})},
+        {"wide", update_command(wide_state())},
+    };
+    const Framing framings[] = {Framing::Ndjson, Framing::MsgPack, Framing::Cbor};
+
+    for (const auto& p : payloads) {
+        for (Framing framing : framings) {
+            std::string frame;
+            append_frame(frame, p.value, framing);
+            std::string payload(frame_payload(frame, framing));
+
+            std::string encode_name = std::string("encode/") + framing_name(framing) + "/" + p.label;
+            std::string out;
+            bench(encode_name.c_str(), 1, [&] {
+                out.clear();
+                append_frame(out, p.value, framing);
+                keep(out);
+            });
+
+            std::string decode_name = std::string("decode/") + framing_name(framing) + "/" + p.label;
+            bench(decode_name.c_str(), 1, [&] { keep(decode_payload(payload, framing)); });
+        }
+    }
+}
+
+// ---- Commands ----
+
+static void bench_commands() {
+    CounterProcess process(2.0);
+    Session session;
+
+    json update = update_command(json{{"counter", 1.0}});
+    bench("run_command/update", 1, [&] { keep(run_command(update, process, &session)); });
+
+    json wide = update_command(wide_state());
+    bench("run_command/update/wide", 1, [&] { keep(run_command(wide, process, &session)); });
+
+    json inputs = json{{"command", "inputs"}};
+    bench("run_command/inputs", 1, [&] { keep(run_command(inputs, process, &session)); });
+
+    json entries = json::array();
+    for (size_t i = 0; i < BATCH_ENTRIES; ++i) {
+        entries.push_back(json{{"state", {{"counter", static_cast<double>(i)}}}, {"interval", 0.5}});
+    }
+    json batch = json{{"command", "update_batch"},
+                      {"arguments", {{"entries", entries}, {"parallel", false}}}};
+    bench("run_command/update_batch", BATCH_ENTRIES, [&] { keep(run_command(batch, process, &session)); });
+
+    json counters = json::array();
+    for (size_t i = 0; i < COLUMN_ROWS; ++i) counters.push_back(static_cast<double>(i));
+    json columns = json{{"command", "update_columns"},
+                        {"arguments", {{"columns", {{"counter", counters}}}, {"interval", 0.5}, {"parallel", false}}}};
+    bench("run_command/update_columns", COLUMN_ROWS, [&] { keep(run_command(columns, process, &session)); });
+}
+
+// Whole update requests from raw bytes to reply, through the DOM and
+// through the fast path of fast_update.hpp.
+static void bench_fast_update() {
+    CounterProcess process(2.0);
+    Session session;
+    const struct {
+        const char* label;
+        std::string line;
+    } requests[] = {
+        {"small", update_command(json{{"counter", 1.0}}).dump()},
+        {"wide", update_command(wide_state()).dump()},
+    };
+    for (const auto& r : requests) {
+        std::string dom_name = std::string("update/dom/") + r.label;
+        bench(dom_name.c_str(), 1, [&] {
+            keep(run_command(decode_payload(r.line, Framing::Ndjson), process, &session));
+        });
+
+        std::string fast_name = std::string("update/fast/") + r.label;
+        FastUpdate update;
+        bench(fast_name.c_str(), 1, [&] {
+            if (parse_fast_update(r.line.data(), r.line.size(), Framing::Ndjson, process, update)) {
+                keep(run_fast_update(process, update));
+            }
+        });
+    }
+}
+
+// A repeated update answered from the result cache: the fast parse, the
+// key, the lookup and the cached frame, against update/fast above.
+struct DeterministicCounter : CounterProcess {
+    using CounterProcess::CounterProcess;
+    bool deterministic() const override { return true; }
+};
+
+static void bench_result_cache() {
+    DeterministicCounter process(2.0);
+    Session session;
+    const struct {
+        const char* label;
+        std::string line;
+    } requests[] = {
+        {"small", update_command(json{{"counter", 1.0}}).dump()},
+        {"wide", update_command(wide_state()).dump()},
+    };
+    for (const auto& r : requests) {
+        FastUpdate update;
+        ResultKey key;
+        if (!parse_fast_update(r.line.data(), r.line.size(), Framing::Ndjson, process, update) ||
+            !result_key(process, update.inputs.data(), update.interval, key)) {
+            continue;
+        }
+        ResultCache::instance().insert(key, run_fast_update(process, update));
+
+        std::string name = std::string("result_cache/hit/") + r.label;
+        bench(name.c_str(), 1, [&] {
+            if (parse_fast_update(r.line.data(), r.line.size(), Framing::Ndjson, process, update) &&
+                result_key(process, update.inputs.data(), update.interval, key)) {
+                keep(ResultCache::instance().find(key)->frame(Framing::Ndjson));
+            }
+        });
+    }
+}
+
+// ---- Process ----
+
+static void bench_process() {
+    CounterProcess process(2.0);
+    json state = json{{"counter", 1.0}};
+    bench("CounterProcess::update", 1, [&] { keep(process.update(state, 0.5)); });
+
+    double in = 1.0;
+    double out = 0.0;
+    bench("CounterProcess::update_typed", 1, [&] {
+        process.update_typed(&in, &out, 0.5);
+        keep(out);
+    });
+
+    ColumnBuffer columns(process, COLUMN_ROWS);
+    for (size_t i = 0; i < COLUMN_ROWS; ++i) {
+        columns.in(0)[i] = static_cast<double>(i);
+        columns.intervals()[i] = 0.5;
+    }
+    bench("CounterProcess::update_columns", COLUMN_ROWS, [&] {
+        columns.update(process, 0, COLUMN_ROWS);
+        keep(columns.out(0)[0]);
+    });
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) FILTER = argv[1];
+    bench_recv_line();
+    bench_codecs();
+    bench_commands();
+    bench_fast_update();
+    bench_result_cache();
+    bench_process();
+    return 0;
+}
@@ -0,0 +1,145 @@
+#include "admission.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// ---- Rate limiter ----
+
+RateLimiter::RateLimiter(double rate, double burst)
+    : rate_(rate), burst_(std::max(1.0, burst)), tokens_(burst_) {}
+
+bool RateLimiter::take(uint64_t now_ns) {
+    if (rate_ <= 0.0) return true;
+    if (last_ns_ != 0 && now_ns > last_ns_) {
+        tokens_ = std::min(burst_, tokens_ + rate_ * static_cast<double>(now_ns - last_ns_) / 1e9);
+    }
+    last_ns_ = now_ns;
+    if (tokens_ < 1.0) return false;
+    tokens_ -= 1.0;
+    return true;
+}
+
+long RateLimiter::retry_after_ms() const {
+    if (rate_ <= 0.0 || tokens_ >= 1.0) return 0;
+    return static_cast<long>(std::ceil((1.0 - tokens_) / rate_ * 1000.0));
+}
+
+// ---- Connection slots ----
+
+ConnectionSlots& ConnectionSlots::instance() {
+    static ConnectionSlots slots;
+    return slots;
+}
+
+bool ConnectionSlots::acquire(std::size_t max) {
+    std::size_t open = open_.load(std::memory_order_relaxed);
+    do {
+        if (max > 0 && open >= max) return false;
+    } while (!open_.compare_exchange_weak(open, open + 1, std::memory_order_relaxed));
+    return true;
+}
+
+void ConnectionSlots::release() {
+    open_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+// ---- Replies ----
+
+json busy_reply(const char* reason, long retry_after_ms) {
+    return json{{"error", "busy"}, {"reason", reason}, {"retry_after_ms", retry_after_ms}};
+}
+
+// SAX handler that looks only at the message's own keys and stops as
+// soon as it has seen both "id" and "command"; everything else is
+// skipped without building values.
+class PeekHandler {
+public:
+    using string_t = json::string_t;
+    using binary_t = json::binary_t;
+
+    explicit PeekHandler(RequestPeek& out) : out_(out) {}
+
+    bool null() { return value(json()); }
+    bool boolean(bool val) { return value(json(val)); }
+    bool number_integer(json::number_integer_t val) { return value(json(val)); }
+    bool number_unsigned(json::number_unsigned_t val) { return value(json(val)); }
+    bool number_float(json::number_float_t val, const string_t&) { return value(json(val)); }
+    bool binary(binary_t&) { return value(json(json::value_t::discarded)); }
+    bool string(string_t& val) {
+        if (depth_ == 1 && expect_ == Expect::Command) {
+            out_.cancel = val == "cancel";
+            out_.protocol = val == "protocol";
+            seen_command_ = true;
+            expect_ = Expect::None;
+            return !done();
+        }
+        return value(json(std::move(val)));
+    }
+
+    bool start_object(std::size_t) { return open(); }
+    bool start_array(std::size_t) { return open(); }
+    bool end_object() { return close(); }
+    bool end_array() { return close(); }
+
+    bool key(string_t& name) {
+        if (depth_ == 1) {
+            expect_ = name == "id" ? Expect::Id : name == "command" ? Expect::Command : Expect::None;
+        }
+        return true;
+    }
+
+    bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception&) {
+        return false;
+    }
+
+private:
+    enum class Expect { None, Id, Command };
+
+    bool done() const { return seen_id_ && seen_command_; }
+
+    bool value(json val) {
+        if (depth_ == 1 && expect_ == Expect::Id) {
+            out_.id = std::move(val);
+            seen_id_ = true;
+        } else if (depth_ == 1 && expect_ == Expect::Command) {
+            seen_command_ = true;  // not a string: never a cancel
+        }
+        if (depth_ == 1) expect_ = Expect::None;
+        return !done();
+    }
+
+    bool open() {
+        if (depth_ == 1 && expect_ != Expect::None) {
+            // A structured id is left out; the reply goes without it.
+            if (expect_ == Expect::Id) seen_id_ = true;
+            if (expect_ == Expect::Command) seen_command_ = true;
+            expect_ = Expect::None;
+        }
+        ++depth_;
+        return !done();
+    }
+
+    bool close() {
+        --depth_;
+        return true;
+    }
+
+    RequestPeek& out_;
+    int depth_ = 0;
+    Expect expect_ = Expect::None;
+    bool seen_id_ = false;
+    bool seen_command_ = false;
+};
+
+RequestPeek peek_request(const std::string& payload, Framing framing) {
+    RequestPeek peek;
+    PeekHandler handler(peek);
+    json::sax_parse(payload.data(), payload.data() + payload.size(), &handler, sax_format(framing),
+                    /*strict=*/false);
+    return peek;
+}
+
+bool may_be_cancel(const std::string& payload) {
+    return ::memmem(payload.data(), payload.size(), "cancel", 6) != nullptr;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "framing.hpp"
+#include "process.hpp"
+
+// ----------------------- Admission control -----------------------
+// What the server turns away instead of queueing, so that one client
+// cannot use up memory and workers that others are waiting for:
+//
+//   max_connections     connections past the limit are answered and
+//                       closed as soon as they are accepted;
+//   max_request_rate    each connection's requests go through a token
+//                       bucket, refilled at this many per second and
+//                       holding up to request_burst;
+//   shed_queue_depth    while the worker pool has more tasks than this
+//                       waiting, new requests are not queued at all.
+//
+// A turned-away request is answered right away, in request order, with
+//
+//   {"error": "busy", "reason": "...", "retry_after_ms": n}
+//
+// carrying the request's id if it has a plain one. A "cancel" is never
+// turned away and does not count against the rate, since it only frees
+// resources. max_line_bytes and
+// max_inflight (config.hpp) bound each connection's memory alongside.
+
+// Token bucket. A rate of 0 never limits.
+class RateLimiter {
+public:
+    RateLimiter(double rate, double burst);
+
+    // Takes a token if there is one.
+    bool take(uint64_t now_ns);
+    // How long until the next token.
+    long retry_after_ms() const;
+
+private:
+    double rate_;
+    double burst_;
+    double tokens_;
+    uint64_t last_ns_ = 0;
+};
+
+// Open client connections across every reactor.
+class ConnectionSlots {
+public:
+    static ConnectionSlots& instance();
+
+    // Reserves a slot unless `max` (0 is unlimited) are taken.
+    bool acquire(std::size_t max);
+    void release();
+
+private:
+    std::atomic<std::size_t> open_{0};
+};
+
+json busy_reply(const char* reason, long retry_after_ms);
+
+// What the reactor needs known about a request without decoding all of
+// it: its scalar "id", if any, and whether it is a cancel or a protocol
+// switch.
+struct RequestPeek {
+    json id = json(json::value_t::discarded);
+    bool cancel = false;
+    bool protocol = false;
+};
+RequestPeek peek_request(const std::string& payload, Framing framing);
+
+// False only if `payload` cannot be a cancel; cheap enough to run on
+// every message. Strings are stored verbatim in every framing.
+bool may_be_cancel(const std::string& payload);
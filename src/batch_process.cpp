@@ -0,0 +1,61 @@
+#include "batch_process.hpp"
+
+#include <algorithm>
+
+void BatchProcess::update_typed(const double* in, double* out, double interval) {
+    thread_local std::vector<const double*> in_cols;
+    thread_local std::vector<double*> out_cols;
+    in_cols.resize(input_layout().size());
+    out_cols.resize(output_layout().size());
+    for (std::size_t s = 0; s < in_cols.size(); ++s) in_cols[s] = in + s;
+    for (std::size_t s = 0; s < out_cols.size(); ++s) out_cols[s] = out + s;
+
+    BatchColumns batch;
+    batch.rows = 1;
+    batch.in = in_cols.data();
+    batch.out = out_cols.data();
+    batch.intervals = &interval;
+    update_columns(batch);
+}
+
+ColumnBuffer::ColumnBuffer(const TypedProcess& process, std::size_t rows)
+    : rows_(rows),
+      inputs_(process.input_layout().size()),
+      outputs_(process.output_layout().size()),
+      in_(inputs_ * rows),
+      out_(outputs_ * rows),
+      intervals_(rows) {
+    const StateLayout& layout = process.input_layout();
+    for (std::size_t s = 0; s < inputs_; ++s) {
+        std::fill(in(s), in(s) + rows, layout.defaults[s]);
+    }
+}
+
+void ColumnBuffer::update(TypedProcess& process, std::size_t begin, std::size_t end) {
+    if (begin >= end) return;
+
+    if (auto* batch_process = dynamic_cast<BatchProcess*>(&process)) {
+        std::vector<const double*> in_cols(inputs_);
+        std::vector<double*> out_cols(outputs_);
+        for (std::size_t s = 0; s < inputs_; ++s) in_cols[s] = in(s) + begin;
+        for (std::size_t s = 0; s < outputs_; ++s) out_cols[s] = out(s) + begin;
+
+        BatchColumns batch;
+        batch.rows = end - begin;
+        batch.in = in_cols.data();
+        batch.out = out_cols.data();
+        batch.intervals = intervals() + begin;
+        batch_process->update_columns(batch);
+        return;
+    }
+
+    // Gather each row into slots and scatter the result back.
+    std::vector<double> row_in(inputs_);
+    std::vector<double> row_out(outputs_);
+    for (std::size_t i = begin; i < end; ++i) {
+        for (std::size_t s = 0; s < inputs_; ++s) row_in[s] = in(s)[i];
+        std::fill(row_out.begin(), row_out.end(), 0.0);
+        process.update_typed(row_in.data(), row_out.data(), intervals_[i]);
+        for (std::size_t s = 0; s < outputs_; ++s) out(s)[i] = row_out[s];
+    }
+}
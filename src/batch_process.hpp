@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "typed_process.hpp"
+
+// ----------------------- Batch process ---------------------------
+// A TypedProcess that also updates many independent states in one call.
+// The batch comes as structure-of-arrays columns: every input slot is
+// one contiguous column with a value per row, and likewise for outputs,
+// so a kernel over a port is a unit-stride loop the compiler can
+// vectorize. update_batch and update_columns hand a BatchProcess whole
+// chunks of rows instead of calling update() once per entry.
+
+struct BatchColumns {
+    std::size_t rows = 0;
+    const double* const* in = nullptr;  // in[slot][row], one column per input slot
+    double* const* out = nullptr;       // out[slot][row], one column per output slot
+    const double* intervals = nullptr;  // one per row
+};
+
+class BatchProcess : public TypedProcess {
+public:
+    using TypedProcess::TypedProcess;
+
+    // Rows are independent and columns never alias. Output columns come
+    // zeroed.
+    virtual void update_columns(const BatchColumns& batch) = 0;
+
+    // One update is a batch of one row; override it if a scalar version
+    // is cheaper.
+    void update_typed(const double* in, double* out, double interval) override;
+};
+
+// Owns the columns of a batch of `rows` rows laid out for `process`.
+class ColumnBuffer {
+public:
+    ColumnBuffer(const TypedProcess& process, std::size_t rows);
+
+    std::size_t rows() const { return rows_; }
+    double* in(std::size_t slot) { return in_.data() + slot * rows_; }
+    double* out(std::size_t slot) { return out_.data() + slot * rows_; }
+    double* intervals() { return intervals_.data(); }
+
+    // Runs rows [begin, end) through `process`: one update_columns() call
+    // for a BatchProcess, one update_typed() per row otherwise. Chunks
+    // that do not overlap may run concurrently if the process allows it.
+    void update(TypedProcess& process, std::size_t begin, std::size_t end);
+
+private:
+    std::size_t rows_;
+    std::size_t inputs_;
+    std::size_t outputs_;
+    std::vector<double> in_;
+    std::vector<double> out_;
+    std::vector<double> intervals_;
+};
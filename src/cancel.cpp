@@ -0,0 +1,23 @@
+#include "cancel.hpp"
+
+static thread_local const CancelToken* CURRENT = nullptr;
+
+const CancelToken* current_cancel_token() {
+    return CURRENT;
+}
+
+bool cancel_requested() {
+    return CURRENT != nullptr && CURRENT->cancelled();
+}
+
+void throw_if_cancelled() {
+    if (cancel_requested()) throw Cancelled();
+}
+
+CancelScope::CancelScope(const CancelToken* token) : previous_(CURRENT) {
+    CURRENT = token;
+}
+
+CancelScope::~CancelScope() {
+    CURRENT = previous_;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+#include <exception>
+
+// ----------------------- Cancellation ----------------------------
+// Cooperative cancellation for long requests. The server installs the
+// token of the request it is running as the thread's current token
+// (CancelScope); code that loops for a long time polls
+// cancel_requested() or calls throw_if_cancelled() between steps. The
+// built-in run loop and update_batch chunks already do. A request whose
+// token is cancelled before it starts does not run at all.
+
+class CancelToken {
+public:
+    void cancel() { cancelled_.store(true, std::memory_order_relaxed); }
+    bool cancelled() const { return cancelled_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<bool> cancelled_{false};
+};
+
+// Thrown by throw_if_cancelled(); the client gets {"error": "cancelled"}.
+struct Cancelled : std::exception {
+    const char* what() const noexcept override { return "cancelled"; }
+};
+
+// The current thread's token, or nullptr outside a cancellable request.
+const CancelToken* current_cancel_token();
+bool cancel_requested();
+void throw_if_cancelled();
+
+// Makes `token` the thread's current token for its lifetime.
+class CancelScope {
+public:
+    explicit CancelScope(const CancelToken* token);
+    ~CancelScope();
+
+    CancelScope(const CancelScope&) = delete;
+    CancelScope& operator=(const CancelScope&) = delete;
+
+private:
+    const CancelToken* previous_;
+};
@@ -0,0 +1,258 @@
+#include "composite_process.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <set>
+#include <stdexcept>
+#include <thread>
+
+#include "registry.hpp"
+#include "run.hpp"
+
+// ---- Building ----
+
+static std::set<std::string> keys_of(const std::vector<std::pair<std::string, std::string>>& ports) {
+    std::set<std::string> keys;
+    for (const auto& port : ports) keys.insert(port.second);
+    return keys;
+}
+
+static bool overlaps(const std::set<std::string>& a, const std::set<std::string>& b) {
+    for (const std::string& key : a) {
+        if (b.count(key)) return true;
+    }
+    return false;
+}
+
+// FNV-1a over the composite's schemas, so its schema cache entries
+// change with the config.
+static uint64_t schemas_hash(const json& inputs, const json& outputs) {
+    uint64_t hash = 1469598103934665603ull;
+    for (const std::string& text : {inputs.dump(), outputs.dump()}) {
+        for (unsigned char c : text) {
+            hash ^= c;
+            hash *= 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+std::unique_ptr<CompositeProcess> CompositeProcess::build(const json& cfg) {
+    auto it = cfg.find("processes");
+    if (it == cfg.end() || !it->is_array() || it->empty()) {
+        throw std::invalid_argument("a composite needs a non-empty 'processes' list");
+    }
+
+    auto plan = std::make_shared<Plan>();
+    std::vector<std::unique_ptr<Process>> processes;
+    std::set<std::string> names;
+    bool all_stateless = true;
+    bool all_concurrent = true;
+    bool all_deterministic = true;
+    for (const json& entry : *it) {
+        if (!entry.is_object() || !entry.contains("name") || !entry.at("name").is_string() ||
+            !entry.contains("process") || !entry.at("process").is_string()) {
+            throw std::invalid_argument("every composite member needs a 'name' and a 'process'");
+        }
+        Member member;
+        member.name = entry.at("name").get<std::string>();
+        member.config = entry;
+        if (!names.insert(member.name).second) {
+            throw std::invalid_argument("composite member '" + member.name + "' is listed twice");
+        }
+        std::string type = entry.at("process").get<std::string>();
+        std::unique_ptr<Process> process = ProcessRegistry::instance().build(type, entry);
+        if (!process) {
+            throw std::invalid_argument("composite member '" + member.name + "': unknown process '" + type +
+                                        "' (registered: " + registered_process_names() + ")");
+        }
+
+        Concurrency c = process->concurrency();
+        if (c == Concurrency::ThreadAffine) {
+            throw std::invalid_argument("composite member '" + member.name + "' is thread-affine");
+        }
+        all_stateless = all_stateless && c == Concurrency::Stateless;
+        all_concurrent = all_concurrent && (c == Concurrency::Stateless || c == Concurrency::Reentrant);
+        all_deterministic = all_deterministic && process->deterministic();
+
+        json wires = entry.value("wires", json::object());
+        if (!wires.is_object()) {
+            throw std::invalid_argument("composite member '" + member.name + "': 'wires' must be an object");
+        }
+        auto key_of = [&](const std::string& port) {
+            auto wire = wires.find(port);
+            if (wire == wires.end()) return port;
+            if (!wire->is_string()) {
+                throw std::invalid_argument("composite member '" + member.name + "': wire for '" + port +
+                                            "' must be a state key");
+            }
+            return wire->get<std::string>();
+        };
+        const json inputs = process->inputs();
+        const json outputs = process->outputs();
+        for (auto wire = wires.begin(); wire != wires.end(); ++wire) {
+            if (!inputs.contains(wire.key()) && !outputs.contains(wire.key())) {
+                throw std::invalid_argument("composite member '" + member.name + "' has no port '" +
+                                            wire.key() + "'");
+            }
+        }
+
+        member.write_schema = json::object();
+        for (auto port = inputs.begin(); port != inputs.end(); ++port) {
+            std::string key = key_of(port.key());
+            member.reads.emplace_back(port.key(), key);
+            if (!plan->inputs.contains(key)) plan->inputs[key] = port.value();
+        }
+        for (auto port = outputs.begin(); port != outputs.end(); ++port) {
+            std::string key = key_of(port.key());
+            member.writes.emplace_back(port.key(), key);
+            member.write_schema[key] = port.value();
+            // Folded into the current value, so the composite needs that
+            // even if no member reads it.
+            Apply rule = apply_rule(port.value());
+            if ((rule == Apply::Accumulate || rule == Apply::Merge) && !plan->inputs.contains(key)) {
+                json schema = port.value();
+                schema.erase("_apply");
+                plan->inputs[key] = std::move(schema);
+            }
+            if (!plan->outputs.contains(key)) {
+                json schema = port.value().is_object() ? port.value() : json::object();
+                schema["_apply"] = "set";
+                plan->outputs[key] = std::move(schema);
+            }
+        }
+        plan->members.push_back(std::move(member));
+        processes.push_back(std::move(process));
+    }
+    if (plan->inputs.is_null()) plan->inputs = json::object();
+    if (plan->outputs.is_null()) plan->outputs = json::object();
+
+    // A member runs after every earlier member whose outputs it reads,
+    // and no earlier than an earlier member that reads or writes what it
+    // writes, so list order decides who sees and wins what.
+    const std::vector<Member>& members = plan->members;
+    std::vector<std::size_t> stage_of(members.size(), 0);
+    std::vector<std::set<std::string>> reads(members.size());
+    std::vector<std::set<std::string>> writes(members.size());
+    for (std::size_t j = 0; j < members.size(); ++j) {
+        reads[j] = keys_of(members[j].reads);
+        writes[j] = keys_of(members[j].writes);
+        for (std::size_t i = 0; i < j; ++i) {
+            if (overlaps(writes[i], reads[j])) {
+                stage_of[j] = std::max(stage_of[j], stage_of[i] + 1);
+            } else if (overlaps(reads[i], writes[j]) || overlaps(writes[i], writes[j])) {
+                stage_of[j] = std::max(stage_of[j], stage_of[i]);
+            }
+        }
+        if (plan->stages.size() <= stage_of[j]) plan->stages.resize(stage_of[j] + 1);
+        plan->stages[stage_of[j]].push_back(j);
+    }
+
+    std::size_t widest = 0;
+    for (const auto& stage : plan->stages) widest = std::max(widest, stage.size());
+    // parallel_for counts the calling thread as one of the pool's, so a
+    // pool of `widest` runs the widest stage all at once.
+    long threads = std::min<long>(static_cast<long>(widest), std::max(1u, std::thread::hardware_concurrency()));
+    if (cfg.contains("threads")) {
+        try { threads = cfg.at("threads").get<long>(); } catch (...) {}
+    }
+    if (threads > 1 && widest > 1) plan->pool = std::make_unique<WorkerPool>(static_cast<std::size_t>(threads));
+
+    plan->concurrency = all_stateless    ? Concurrency::Stateless
+                        : all_concurrent ? Concurrency::Reentrant
+                                         : Concurrency::Serialized;
+    plan->deterministic = all_deterministic;
+    plan->schema_version = schemas_hash(plan->inputs, plan->outputs);
+    return std::unique_ptr<CompositeProcess>(new CompositeProcess(std::move(plan), std::move(processes)));
+}
+
+std::unique_ptr<Process> CompositeProcess::clone() const {
+    std::vector<std::unique_ptr<Process>> processes;
+    for (std::size_t m = 0; m < processes_.size(); ++m) {
+        processes.push_back(instantiate_process(*processes_[m], plan_->members[m].config));
+    }
+    return std::unique_ptr<Process>(new CompositeProcess(plan_, std::move(processes)));
+}
+
+// ---- Updating ----
+
+json CompositeProcess::update(const json& state, double interval) {
+    const Plan& plan = *plan_;
+    json working = state.is_object() ? state : json::object();
+    std::vector<json> results(plan.members.size());
+
+    for (const std::vector<std::size_t>& stage : plan.stages) {
+        // Inputs are gathered while nothing writes to `working`.
+        const json& view = working;
+        auto run_member = [&](std::size_t m) {
+            json in = json::object();
+            for (const auto& port : plan.members[m].reads) {
+                auto value = view.find(port.second);
+                if (value != view.end()) in[port.first] = *value;
+            }
+            results[m] = processes_[m]->update(in, interval);
+        };
+        if (plan.pool && stage.size() > 1) {
+            plan.pool->parallel_for(stage.size(), 1, [&](std::size_t begin, std::size_t end) {
+                for (std::size_t i = begin; i < end; ++i) run_member(stage[i]);
+            });
+        } else {
+            for (std::size_t m : stage) run_member(m);
+        }
+
+        // Folded in list order, so the later of two writers applies last.
+        for (std::size_t m : stage) {
+            const Member& member = plan.members[m];
+            json& result = results[m];
+            if (result.is_object() && result.contains("error")) {
+                const json& error = result.at("error");
+                return json{{"error", member.name + ": " +
+                                          (error.is_string() ? error.get<std::string>() : error.dump())}};
+            }
+            if (!result.is_object()) continue;
+            json update = json::object();
+            for (const auto& port : member.writes) {
+                auto value = result.find(port.first);
+                if (value != result.end()) update[port.second] = std::move(*value);
+            }
+            apply_update(working, update, member.write_schema);
+        }
+    }
+
+    json out = json::object();
+    for (auto key = plan.outputs.begin(); key != plan.outputs.end(); ++key) {
+        auto value = working.find(key.key());
+        if (value != working.end()) out[key.key()] = std::move(*value);
+    }
+    return out;
+}
+
+// ---- Checkpoints ----
+
+void CompositeProcess::save_state(std::string& out) const {
+    for (const auto& process : processes_) {
+        uint64_t size = 0;
+        std::size_t at = out.size();
+        out.append(sizeof(size), '\0');
+        process->save_state(out);
+        size = out.size() - at - sizeof(size);
+        std::memcpy(&out[at], &size, sizeof(size));
+    }
+}
+
+void CompositeProcess::load_state(std::string_view image) {
+    std::vector<std::string_view> parts;
+    for (std::size_t m = 0; m < processes_.size(); ++m) {
+        uint64_t size = 0;
+        if (image.size() < sizeof(size)) throw std::runtime_error("not a checkpoint of this composite");
+        std::memcpy(&size, image.data(), sizeof(size));
+        image.remove_prefix(sizeof(size));
+        if (image.size() < size) throw std::runtime_error("not a checkpoint of this composite");
+        parts.push_back(image.substr(0, size));
+        image.remove_prefix(size);
+    }
+    if (!image.empty()) throw std::runtime_error("not a checkpoint of this composite");
+    for (std::size_t m = 0; m < processes_.size(); ++m) processes_[m]->load_state(parts[m]);
+}
+
+REGISTER_PROCESS("composite", [](const json& cfg) { return CompositeProcess::build(cfg); });
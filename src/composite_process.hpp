@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "process.hpp"
+#include "worker_pool.hpp"
+
+// ----------------------- Composite process -----------------------
+// Several registered processes behind one Process, exchanging data in
+// memory instead of through the client:
+//
+//   {"process": "composite",
+//    "processes": [
+//      {"name": "growth", "process": "counter", "rate": 2.0},
+//      {"name": "decay", "process": "decay", "wires": {"y": "counter"}}
+//    ]}
+//
+// The members share one flat state. A port reads and writes the key of
+// the same name unless the member's "wires" maps it to another. Members
+// behave as if they ran one after another in list order, each seeing
+// what the members before it wrote, folded in with their "_apply"
+// rules. Members that do not read each other's outputs run at the same
+// time, on the composite's own thread pool ("threads" in the config,
+// shared by every clone).
+//
+// The composite's inputs are every key a member reads or accumulates or
+// merges into, and its outputs every key a member writes. They are
+// "_apply": "set" and carry the value at the end of the update.
+
+class CompositeProcess : public Process {
+public:
+    // Throws std::invalid_argument if `cfg` does not describe a composite
+    // of registered processes.
+    static std::unique_ptr<CompositeProcess> build(const json& cfg);
+
+    json inputs() const override { return plan_->inputs; }
+    json outputs() const override { return plan_->outputs; }
+    json update(const json& state, double interval) override;
+
+    Concurrency concurrency() const override { return plan_->concurrency; }
+    uint64_t schema_version() const override { return plan_->schema_version; }
+    bool deterministic() const override { return plan_->deterministic; }
+    std::unique_ptr<Process> clone() const override;
+
+    // The members' images in list order, each behind its length.
+    void save_state(std::string& out) const override;
+    void load_state(std::string_view image) override;
+
+private:
+    struct Member {
+        std::string name;
+        json config;                           // the member's entry, to rebuild it
+        std::vector<std::pair<std::string, std::string>> reads;  // port, state key
+        std::vector<std::pair<std::string, std::string>> writes;
+        json write_schema;                     // outputs() keyed by state key
+    };
+    // Everything but the member instances, shared by all clones.
+    struct Plan {
+        std::vector<Member> members;
+        std::vector<std::vector<std::size_t>> stages;  // members that run together
+        json inputs;
+        json outputs;
+        Concurrency concurrency = Concurrency::Serialized;
+        uint64_t schema_version = 0;
+        bool deterministic = false;
+        std::unique_ptr<WorkerPool> pool;  // nullptr when members never run together
+    };
+
+    CompositeProcess(std::shared_ptr<const Plan> plan, std::vector<std::unique_ptr<Process>> processes)
+        : plan_(std::move(plan)), processes_(std::move(processes)) {}
+
+    std::shared_ptr<const Plan> plan_;
+    std::vector<std::unique_ptr<Process>> processes_;  // one per member
+};
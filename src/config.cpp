@@ -0,0 +1,158 @@
+#include "config.hpp"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+#include "counter_process.hpp"
+#include "mapped_file.hpp"
+#include "registry.hpp"
+
+static const char* DEFAULT_CONFIG_PATH = "/config/config.json";
+static const char* FALLBACK_CONFIG_PATH = "config/default_config.json";
+
+// Parsed straight from a mapping of the file rather than through a
+// stream, which reads a character at a time.
+json read_json_file(const std::string& path) {
+    try {
+        MappedFile file(path);
+        return json::parse(file.data(), file.data() + file.size());
+    } catch (...) {
+        return json::object();
+    }
+}
+
+json read_config() {
+    const char* env_path = std::getenv("CONFIG_PATH");
+    std::string primary = env_path ? std::string(env_path) : std::string(DEFAULT_CONFIG_PATH);
+
+    // Try primary, else fallback
+    std::ifstream f1(primary);
+    if (f1.good()) {
+        return read_json_file(primary);
+    }
+    return read_json_file(FALLBACK_CONFIG_PATH);
+}
+
+std::unique_ptr<Process> build_process_from_config(const json& cfg) {
+    std::string pname = "counter";
+    if (cfg.contains("process")) {
+        try { pname = cfg.at("process").get<std::string>(); } catch (...) {}
+    }
+
+    if (auto process = ProcessRegistry::instance().build(pname, cfg)) {
+        return process;
+    }
+
+    // default
+    std::cerr << "unknown process '" << pname << "' (registered: " << registered_process_names()
+              << "), using counter\n";
+    return std::make_unique<CounterProcess>();
+}
+
+// Environment wins over the config section, which wins over the default.
+static std::string server_string_option(const json& section, const char* key, const char* env,
+                                        const std::string& def) {
+    if (const char* v = std::getenv(env)) {
+        return v;
+    }
+    if (section.contains(key)) {
+        try { return section.at(key).get<std::string>(); } catch (...) {}
+    }
+    return def;
+}
+
+static long server_option(const json& section, const char* key, const char* env, long def) {
+    if (const char* v = std::getenv(env)) {
+        return std::atol(v);
+    }
+    if (section.contains(key)) {
+        try { return section.at(key).get<long>(); } catch (...) {}
+    }
+    return def;
+}
+
+static double server_double_option(const json& section, const char* key, const char* env, double def) {
+    if (const char* v = std::getenv(env)) {
+        return std::atof(v);
+    }
+    if (section.contains(key)) {
+        try { return section.at(key).get<double>(); } catch (...) {}
+    }
+    return def;
+}
+
+ServerOptions read_server_options(const json& cfg) {
+    json section = json::object();
+    if (cfg.contains("server") && cfg.at("server").is_object()) {
+        section = cfg.at("server");
+    }
+
+    ServerOptions opts;
+    long workers = server_option(section, "workers", "WORKERS", 0);
+    if (workers <= 0) {
+        workers = static_cast<long>(std::thread::hardware_concurrency());
+    }
+    opts.workers = workers > 0 ? static_cast<std::size_t>(workers) : 1;
+
+    long max_line = server_option(section, "max_line_bytes", "MAX_LINE_BYTES",
+                                  static_cast<long>(opts.max_line_bytes));
+    if (max_line > 0) opts.max_line_bytes = static_cast<std::size_t>(max_line);
+
+    long inflight = server_option(section, "max_inflight", "MAX_INFLIGHT",
+                                  static_cast<long>(opts.max_inflight));
+    if (inflight > 0) opts.max_inflight = static_cast<std::size_t>(inflight);
+
+    long max_output = server_option(section, "max_output_bytes", "MAX_OUTPUT_BYTES",
+                                    static_cast<long>(opts.max_output_bytes));
+    if (max_output > 0) opts.max_output_bytes = static_cast<std::size_t>(max_output);
+
+    long max_connections = server_option(section, "max_connections", "MAX_CONNECTIONS", 0);
+    if (max_connections > 0) opts.max_connections = static_cast<std::size_t>(max_connections);
+    double rate = server_double_option(section, "max_request_rate", "MAX_REQUEST_RATE", 0.0);
+    if (rate > 0.0) opts.max_request_rate = rate;
+    double burst = server_double_option(section, "request_burst", "REQUEST_BURST", 0.0);
+    opts.request_burst = burst > 0.0 ? burst : opts.max_request_rate;
+    long shed = server_option(section, "shed_queue_depth", "SHED_QUEUE_DEPTH", 0);
+    if (shed > 0) opts.shed_queue_depth = static_cast<std::size_t>(shed);
+
+    opts.share_process = server_option(section, "share_process", "SHARE_PROCESS", 0) != 0;
+
+    opts.socket_path = server_string_option(section, "socket_path", "SOCKET_PATH", "");
+    opts.shm_name = server_string_option(section, "shm_name", "SHM_NAME", "");
+    long shm_bytes = server_option(section, "shm_bytes", "SHM_BYTES", static_cast<long>(opts.shm_bytes));
+    if (shm_bytes > 0) opts.shm_bytes = static_cast<std::size_t>(shm_bytes);
+
+    long acceptors = server_option(section, "acceptors", "ACCEPTORS", static_cast<long>(opts.acceptors));
+    if (acceptors > 0) opts.acceptors = static_cast<std::size_t>(acceptors);
+
+    SocketOptions& sock = opts.socket;
+    long backlog = server_option(section, "backlog", "BACKLOG", sock.backlog);
+    if (backlog > 0) sock.backlog = static_cast<int>(backlog);
+    sock.tcp_nodelay = server_option(section, "tcp_nodelay", "TCP_NODELAY", sock.tcp_nodelay) != 0;
+    sock.send_buffer = static_cast<int>(server_option(section, "send_buffer", "SEND_BUFFER", 0));
+    sock.recv_buffer = static_cast<int>(server_option(section, "recv_buffer", "RECV_BUFFER", 0));
+    // Several acceptors can only share the port through SO_REUSEPORT.
+    sock.reuse_port = server_option(section, "reuse_port", "REUSE_PORT", 0) != 0 || opts.acceptors > 1;
+
+    opts.metrics = server_option(section, "metrics", "METRICS", opts.metrics) != 0;
+    opts.metrics_port = static_cast<int>(server_option(section, "metrics_port", "METRICS_PORT", 0));
+
+    long drain = server_option(section, "drain_timeout_ms", "DRAIN_TIMEOUT_MS", opts.drain_timeout_ms);
+    if (drain >= 0) opts.drain_timeout_ms = drain;
+
+    opts.checkpoint_dir = server_string_option(section, "checkpoint_dir", "CHECKPOINT_DIR", "");
+    opts.restore_checkpoint = server_string_option(section, "restore_checkpoint", "RESTORE_CHECKPOINT", "");
+
+    long cache = server_option(section, "result_cache_entries", "RESULT_CACHE_ENTRIES",
+                               static_cast<long>(opts.result_cache_entries));
+    if (cache >= 0) opts.result_cache_entries = static_cast<std::size_t>(cache);
+
+    std::string protocol = server_string_option(section, "protocol", "PROTOCOL",
+                                                framing_name(opts.protocol));
+    if (!parse_framing(protocol, opts.protocol)) {
+        std::cerr << "unknown protocol '" << protocol << "', using " << framing_name(opts.protocol) << "\n";
+    }
+    return opts;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#include "framing.hpp"
+#include "net.hpp"
+#include "process.hpp"
+
+// ----------------------- Config helpers --------------------------
+
+json read_json_file(const std::string& path);
+json read_config();
+std::unique_ptr<Process> build_process_from_config(const json& cfg);
+
+// Server tuning, read from the optional "server" section of the config.
+// Every field can be overridden by the environment variable named next
+// to it.
+struct ServerOptions {
+    std::size_t workers = 0;  // WORKERS; 0 means one per hardware thread
+    std::size_t max_line_bytes = 64 * 1024 * 1024;  // MAX_LINE_BYTES, per line or frame
+    std::size_t max_inflight = 64;                  // MAX_INFLIGHT, requests per connection
+    std::size_t max_output_bytes = 64 * 1024 * 1024;  // MAX_OUTPUT_BYTES, unsent replies per connection
+    std::size_t max_connections = 0;  // MAX_CONNECTIONS, across all listeners; 0 is unlimited
+    double max_request_rate = 0.0;    // MAX_REQUEST_RATE, per connection per second; 0 is unlimited
+    double request_burst = 0.0;       // REQUEST_BURST, requests above that rate; 0 means one second's worth
+    std::size_t shed_queue_depth = 0;  // SHED_QUEUE_DEPTH: waiting pool tasks that turn requests away; 0 is off
+    Framing protocol = Framing::Ndjson;               // PROTOCOL, initial framing of a connection
+    bool share_process = false;  // SHARE_PROCESS: one Process for all connections
+    std::string socket_path;     // SOCKET_PATH: also listen on this Unix domain socket
+    std::string shm_name;        // SHM_NAME: also serve a shared-memory segment by this name
+    std::size_t shm_bytes = 64 * 1024 * 1024;  // SHM_BYTES, per ring of that segment
+    std::size_t acceptors = 1;  // ACCEPTORS: event loops, each with its own SO_REUSEPORT listener
+    SocketOptions socket;       // BACKLOG, TCP_NODELAY, SEND_BUFFER, RECV_BUFFER, REUSE_PORT
+    bool metrics = true;        // METRICS: record counters and latency histograms
+    int metrics_port = 0;       // METRICS_PORT: serve them to Prometheus over HTTP; 0 is off
+    long drain_timeout_ms = 10000;  // DRAIN_TIMEOUT_MS: how long shutdown waits for queued requests
+    std::string checkpoint_dir;      // CHECKPOINT_DIR: enables checkpoint/restore in this directory
+    std::string restore_checkpoint;  // RESTORE_CHECKPOINT: restore the process from this one at startup
+    std::size_t result_cache_entries = 4096;  // RESULT_CACHE_ENTRIES: for deterministic processes; 0 is off
+};
+
+ServerOptions read_server_options(const json& cfg);
@@ -0,0 +1,11 @@
+#include "counter_process.hpp"
+
+#include "registry.hpp"
+
+REGISTER_PROCESS("counter", [](const json& cfg) {
+    double rate = 1.0;
+    if (cfg.contains("rate")) {
+        try { rate = cfg.at("rate").get<double>(); } catch (...) {}
+    }
+    return std::make_unique<CounterProcess>(rate);
+});
@@ -0,0 +1,11 @@
+#include "decay_process.hpp"
+
+#include "registry.hpp"
+
+REGISTER_PROCESS("decay", [](const json& cfg) {
+    double rate = 1.0;
+    if (cfg.contains("rate")) {
+        try { rate = cfg.at("rate").get<double>(); } catch (...) {}
+    }
+    return std::make_unique<DecayProcess>(rate, IntegratorOptions::from_config(cfg));
+});
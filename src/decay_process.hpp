@@ -0,0 +1,32 @@
+#pragma once
+
+#include "ode_process.hpp"
+
+// ----------------------- Example ODE process ---------------------
+// DecayProcess: dy/dt = -rate * y, integrated server-side. A large rate
+// makes it stiff enough that one coarse Euler step overshoots; the
+// "integrator" config picks how the interval is covered.
+
+class DecayProcess : public OdeProcess {
+public:
+    explicit DecayProcess(double rate = 1.0, IntegratorOptions options = {})
+        : OdeProcess(options), rate_(rate) {}
+
+    json inputs() const override { return json{{"y", {{"_type", "number"}}}}; }
+    json outputs() const override { return json{{"y", {{"_type", "number"}, {"_apply", "set"}}}}; }
+
+    void derivatives(const double* y, double t, double* dydt) const override {
+        (void)t;
+        dydt[0] = -rate_ * y[0];
+    }
+
+    Concurrency concurrency() const override { return Concurrency::Stateless; }
+    bool deterministic() const override { return true; }
+
+    std::unique_ptr<Process> clone() const override {
+        return std::make_unique<DecayProcess>(*this);
+    }
+
+private:
+    double rate_;
+};
@@ -0,0 +1,219 @@
+#include "fast_update.hpp"
+
+#include <string>
+
+#include "metrics.hpp"
+
+// SAX handler for {"command":"update","arguments":{"state":{...},"interval":dt}}.
+// It tracks at most three levels of context (message, arguments, state);
+// any value it has no use for is skipped by counting nesting depth.
+// Every `return false` abandons the fast path.
+class FastUpdateHandler {
+public:
+    using string_t = json::string_t;
+    using binary_t = json::binary_t;
+
+    FastUpdateHandler(const TypedProcess& process, FastUpdate& out)
+        : process_(process), layout_(process.input_layout()), out_(out) {
+        reset_inputs();
+        out_.interval = 0.0;
+        out_.id = json();
+        out_.has_id = false;
+    }
+
+    bool is_update() const { return seen_update_; }
+
+    bool null() { return taking_id() ? take_id(json()) : scalar(); }
+    bool boolean(bool val) { return taking_id() ? take_id(json(val)) : scalar(); }
+    bool number_integer(json::number_integer_t val) {
+        return taking_id() ? take_id(json(val)) : number(static_cast<double>(val));
+    }
+    bool number_unsigned(json::number_unsigned_t val) {
+        return taking_id() ? take_id(json(val)) : number(static_cast<double>(val));
+    }
+    bool number_float(json::number_float_t val, const string_t&) {
+        return taking_id() ? take_id(json(val)) : number(val);
+    }
+    bool binary(binary_t&) { return taking_id() ? false : scalar(); }
+
+    bool string(string_t& val) {
+        if (taking_id()) return take_id(json(std::move(val)));
+        if (skip_ == 0 && expect_ == Expect::Command) {
+            expect_ = Expect::None;
+            seen_update_ = val == "update";
+            return seen_update_;
+        }
+        return scalar();
+    }
+
+    bool start_object(std::size_t) { return open(/*object=*/true); }
+    bool start_array(std::size_t) { return open(/*object=*/false); }
+    bool end_object() { return close(); }
+    bool end_array() { return close(); }
+
+    bool key(string_t& name) {
+        if (skip_ > 0) return true;
+        switch (stack_[depth_ - 1]) {
+        case Ctx::Message:
+            if (name == "async") return false;  // handled from the DOM (protocol.hpp)
+            expect_ = name == "command" ? Expect::Command
+                    : name == "arguments" ? Expect::Arguments
+                    : name == "id" ? Expect::Id
+                    : Expect::Skip;
+            break;
+        case Ctx::Arguments:
+            // A delta depends on the session's cached state.
+            if (name == "delta") return false;
+            expect_ = name == "state" ? Expect::State
+                    : name == "interval" ? Expect::Interval
+                    : Expect::Skip;
+            break;
+        case Ctx::State:
+            slot_ = process_.input_slot(name);
+            expect_ = slot_ >= 0 ? Expect::Slot : Expect::Skip;
+            break;
+        }
+        return true;
+    }
+
+    bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception&) {
+        return false;
+    }
+
+private:
+    enum class Ctx { Message, Arguments, State };
+    enum class Expect { None, Skip, Command, Arguments, State, Interval, Slot, Id };
+
+    bool taking_id() const { return skip_ == 0 && expect_ == Expect::Id; }
+
+    bool take_id(json value) {
+        expect_ = Expect::None;
+        out_.id = std::move(value);
+        out_.has_id = true;
+        return true;
+    }
+
+    void reset_inputs() {
+        out_.inputs.assign(layout_.defaults.begin(), layout_.defaults.end());
+    }
+
+    bool number(double val) {
+        if (skip_ > 0) return true;
+        Expect e = expect_;
+        expect_ = Expect::None;
+        switch (e) {
+        case Expect::Interval:
+            out_.interval = val;
+            return true;
+        case Expect::Slot:
+            out_.inputs[slot_] = val;
+            return true;
+        default:
+            expect_ = e;
+            return scalar();
+        }
+    }
+
+    // Any other scalar value. Like the DOM path, a port that is not a
+    // number reads as its default; an interval that is not a number is
+    // an error, which the DOM path reports.
+    bool scalar() {
+        if (skip_ > 0) return true;
+        Expect e = expect_;
+        expect_ = Expect::None;
+        switch (e) {
+        case Expect::Skip:
+            return true;
+        case Expect::State:
+            reset_inputs();  // a state that is not an object reads as all defaults
+            return true;
+        case Expect::Slot:
+            out_.inputs[slot_] = layout_.defaults[slot_];
+            return true;
+        case Expect::Interval:   // an interval that is not a number
+        case Expect::None:       // a message that is not an object
+        case Expect::Command:    // a command that is not a string
+        case Expect::Arguments:  // arguments that are not an object
+        case Expect::Id:         // taken before getting here
+            return false;
+        }
+        return false;
+    }
+
+    bool open(bool object) {
+        if (skip_ > 0) {
+            ++skip_;
+            return true;
+        }
+        Expect e = expect_;
+        expect_ = Expect::None;
+        switch (e) {
+        case Expect::None:
+            if (depth_ != 0 || !object) return false;
+            stack_[depth_++] = Ctx::Message;
+            return true;
+        case Expect::Arguments:
+            if (!object) return false;
+            // A repeated key replaces the earlier value, as in the DOM.
+            reset_inputs();
+            out_.interval = 0.0;
+            stack_[depth_++] = Ctx::Arguments;
+            return true;
+        case Expect::State:
+            reset_inputs();
+            if (object) {
+                stack_[depth_++] = Ctx::State;
+            } else {
+                skip_ = 1;
+            }
+            return true;
+        case Expect::Interval:
+            return false;  // not a number; the DOM path reports it
+        case Expect::Slot:
+            out_.inputs[slot_] = layout_.defaults[slot_];
+            skip_ = 1;
+            return true;
+        case Expect::Skip:
+            skip_ = 1;
+            return true;
+        case Expect::Command:
+        case Expect::Id:  // structured ids are left to the DOM
+            return false;
+        }
+        return false;
+    }
+
+    bool close() {
+        if (skip_ > 0) {
+            --skip_;
+        } else {
+            --depth_;
+        }
+        return true;
+    }
+
+    const TypedProcess& process_;
+    const StateLayout& layout_;
+    FastUpdate& out_;
+    Ctx stack_[3] = {};
+    int depth_ = 0;
+    std::size_t skip_ = 0;  // nesting depth inside a skipped value
+    Expect expect_ = Expect::None;
+    int slot_ = -1;
+    bool seen_update_ = false;
+};
+
+bool parse_fast_update(const char* data, std::size_t size, Framing framing,
+                       const TypedProcess& process, FastUpdate& out) {
+    FastUpdateHandler handler(process, out);
+    bool ok = json::sax_parse(data, data + size, &handler, sax_format(framing), /*strict=*/true);
+    return ok && handler.is_update();
+}
+
+json run_fast_update(TypedProcess& process, const FastUpdate& update) {
+    Metrics& metrics = Metrics::instance();
+    uint64_t start = metrics.enabled() ? metrics_now_ns() : 0;
+    json reply = process.update_inputs(update.inputs.data(), update.interval);
+    if (start) metrics.record_command(CommandKind::Update, metrics_now_ns() - start, false);
+    return reply;
+}
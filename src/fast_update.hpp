@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "framing.hpp"
+#include "pool_allocator.hpp"
+#include "process.hpp"
+#include "typed_process.hpp"
+
+// ----------------------- Fast update path ------------------------
+// For a TypedProcess, an update request only matters through its
+// command name, its interval and the state ports the process declares.
+// parse_fast_update() walks the raw message once with a SAX handler and
+// writes those ports straight into input slots: undeclared fields are
+// skipped without building any JSON for them, and no request DOM is
+// built at all.
+//
+// It gives up (returns false) on anything that is not a plain update
+// with the same reply as the DOM path would produce: another command,
+// a delta, non-object arguments, an "async" flag, an id that is an
+// object or array, malformed input. The caller then
+// decodes the message as usual, so the fast path never changes a reply.
+
+struct FastUpdate {
+    std::vector<double, PoolAllocator<double>> inputs;  // one per input slot
+    double interval = 0.0;
+    json id;  // the request's "id", if it had a scalar one
+    bool has_id = false;
+};
+
+bool parse_fast_update(const char* data, std::size_t size, Framing framing,
+                       const TypedProcess& process, FastUpdate& out);
+
+// Runs a parsed fast update and returns the reply, as run_command would.
+json run_fast_update(TypedProcess& process, const FastUpdate& update);
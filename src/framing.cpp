@@ -0,0 +1,126 @@
+#include "framing.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+bool parse_framing(const std::string& name, Framing& out) {
+    if (name == "ndjson" || name == "json") {
+        out = Framing::Ndjson;
+    } else if (name == "msgpack") {
+        out = Framing::MsgPack;
+    } else if (name == "cbor") {
+        out = Framing::Cbor;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* framing_name(Framing framing) {
+    switch (framing) {
+    case Framing::MsgPack: return "msgpack";
+    case Framing::Cbor:    return "cbor";
+    case Framing::Ndjson:  break;
+    }
+    return "ndjson";
+}
+
+nlohmann::detail::input_format_t sax_format(Framing framing) {
+    switch (framing) {
+    case Framing::MsgPack: return nlohmann::detail::input_format_t::msgpack;
+    case Framing::Cbor:    return nlohmann::detail::input_format_t::cbor;
+    case Framing::Ndjson:  break;
+    }
+    return nlohmann::detail::input_format_t::json;
+}
+
+void append_payload(std::string& out, const json& j, Framing framing) {
+    nlohmann::detail::output_adapter<char> adapter(out);
+    switch (framing) {
+    case Framing::MsgPack:
+        json::to_msgpack(j, adapter);
+        return;
+    case Framing::Cbor:
+        json::to_cbor(j, adapter);
+        return;
+    case Framing::Ndjson:
+        break;
+    }
+    // Same output as j.dump(), written straight into `out` instead of
+    // through a temporary string.
+    nlohmann::detail::serializer<json> serializer(adapter, ' ', json::error_handler_t::strict);
+    serializer.dump(j, false, false, 0);
+}
+
+void append_frame(std::string& out, const json& j, Framing framing) {
+    if (framing == Framing::Ndjson) {
+        append_payload(out, j, framing);
+        out.push_back('\n');
+        return;
+    }
+
+    // Reserve the length prefix, encode in place, then patch the length.
+    size_t header = out.size();
+    out.append(FRAME_HEADER_BYTES, '\0');
+    append_payload(out, j, framing);
+    uint32_t len = static_cast<uint32_t>(out.size() - header - FRAME_HEADER_BYTES);
+    out[header + 0] = static_cast<char>((len >> 24) & 0xff);
+    out[header + 1] = static_cast<char>((len >> 16) & 0xff);
+    out[header + 2] = static_cast<char>((len >> 8) & 0xff);
+    out[header + 3] = static_cast<char>(len & 0xff);
+}
+
+json decode_payload(const char* data, size_t size, Framing framing) {
+    const auto* first = reinterpret_cast<const uint8_t*>(data);
+    switch (framing) {
+    case Framing::MsgPack:
+        return json::from_msgpack(first, first + size, /*strict=*/true, /*allow_exceptions=*/false);
+    case Framing::Cbor:
+        return json::from_cbor(first, first + size, /*strict=*/true, /*allow_exceptions=*/false);
+    case Framing::Ndjson:
+        break;
+    }
+    return json::parse(data, data + size, nullptr, /*allow_exceptions=*/false);
+}
+
+json decode_payload(const std::string& payload, Framing framing) {
+    return decode_payload(payload.data(), payload.size(), framing);
+}
+
+std::string_view frame_payload(const std::string& frame, Framing framing) {
+    std::string_view view(frame);
+    if (is_binary(framing)) {
+        view.remove_prefix(std::min(view.size(), FRAME_HEADER_BYTES));
+    } else if (!view.empty() && view.back() == '\n') {
+        view.remove_suffix(1);
+    }
+    return view;
+}
+
+bool may_be_protocol_command(const std::string& payload) {
+    return ::memmem(payload.data(), payload.size(), "protocol", 8) != nullptr;
+}
+
+bool negotiate_framing(const json& cmd, Framing& framing, json& reply) {
+    if (!cmd.is_object()) return false;
+    auto it = cmd.find("command");
+    if (it == cmd.end() || !it->is_string() || it->get_ref<const std::string&>() != "protocol") {
+        return false;
+    }
+
+    std::string mode;
+    try {
+        mode = cmd.at("arguments").at("mode").get<std::string>();
+    } catch (...) {
+        reply = json{{"error", "protocol expects arguments.mode"}};
+        return true;
+    }
+    Framing next;
+    if (!parse_framing(mode, next)) {
+        reply = json{{"error", std::string("unknown protocol: ") + mode}};
+        return true;
+    }
+    framing = next;
+    reply = json{{"protocol", framing_name(framing)}};
+    return true;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "process.hpp"
+
+// ----------------------- Framing ---------------------------------
+// How messages are cut out of the byte stream and encoded.
+//
+//   ndjson   one JSON text per line (the default)
+//   msgpack  4-byte big-endian length, then a MessagePack payload
+//   cbor     4-byte big-endian length, then a CBOR payload
+//
+// The framing is chosen by server.protocol / PROTOCOL and can be switched
+// per connection with {"command":"protocol","arguments":{"mode":...}};
+// the reply to that command still uses the old framing.
+
+enum class Framing { Ndjson, MsgPack, Cbor };
+
+static const size_t FRAME_HEADER_BYTES = 4;
+
+bool parse_framing(const std::string& name, Framing& out);
+const char* framing_name(Framing framing);
+
+inline bool is_binary(Framing framing) { return framing != Framing::Ndjson; }
+
+// The json::sax_parse() input format of a payload in `framing`.
+nlohmann::detail::input_format_t sax_format(Framing framing);
+
+// Serializes `j` as a bare payload, without newline or length prefix.
+void append_payload(std::string& out, const json& j, Framing framing);
+
+// Serializes `j` as one complete frame (newline or length prefix
+// included) and appends it to `out`.
+void append_frame(std::string& out, const json& j, Framing framing);
+
+// Decodes one payload as cut by LineReader. Returns a discarded value
+// if it cannot be decoded.
+json decode_payload(const std::string& payload, Framing framing);
+json decode_payload(const char* data, size_t size, Framing framing);
+
+// The payload inside a frame built by append_frame().
+std::string_view frame_payload(const std::string& frame, Framing framing);
+
+// False only if `payload` cannot hold a protocol command; cheap enough to
+// run on every message. Strings are stored verbatim in every framing.
+bool may_be_protocol_command(const std::string& payload);
+
+// If `cmd` is a protocol command, switches `framing` (when the requested
+// mode is valid), stores the reply in `reply` and returns true.
+bool negotiate_framing(const json& cmd, Framing& framing, json& reply);
@@ -0,0 +1,64 @@
+#include "line_reader.hpp"
+
+#include <sys/socket.h>
+
+#include <cstring>
+
+LineReader::LineReader(size_t max_line) : max_line_(max_line) {}
+
+ssize_t LineReader::fill(int fd) {
+    if (buf_.size() - end_ < CHUNK) {
+        // Slide the live bytes to the front before growing.
+        if (begin_ > 0) {
+            std::memmove(buf_.data(), buf_.data() + begin_, end_ - begin_);
+            scan_ -= begin_;
+            end_ -= begin_;
+            begin_ = 0;
+        }
+        if (buf_.size() - end_ < CHUNK) {
+            buf_.resize(end_ + CHUNK);
+        }
+    }
+    ssize_t n = ::recv(fd, buf_.data() + end_, buf_.size() - end_, 0);
+    if (n > 0) end_ += static_cast<size_t>(n);
+    return n;
+}
+
+LineReader::Status LineReader::next_line(std::string& line) {
+    const char* base = buf_.data();
+    const void* hit = (scan_ < end_) ? std::memchr(base + scan_, '\n', end_ - scan_) : nullptr;
+    if (!hit) {
+        scan_ = end_;
+        return (end_ - begin_ > max_line_) ? Status::TooLong : Status::NeedMore;
+    }
+
+    size_t nl = static_cast<size_t>(static_cast<const char*>(hit) - base);
+    if (nl - begin_ > max_line_) return Status::TooLong;
+
+    line.assign(base + begin_, nl - begin_);
+    begin_ = scan_ = nl + 1;
+    if (begin_ == end_) begin_ = scan_ = end_ = 0;
+    return Status::Ready;
+}
+
+LineReader::Status LineReader::next_frame(std::string& payload) {
+    const size_t avail = end_ - begin_;
+    if (avail < 4) return Status::NeedMore;
+
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(buf_.data() + begin_);
+    size_t len = (size_t(p[0]) << 24) | (size_t(p[1]) << 16) | (size_t(p[2]) << 8) | size_t(p[3]);
+    if (len > max_line_) return Status::TooLong;
+    if (avail - 4 < len) return Status::NeedMore;
+
+    payload.assign(buf_.data() + begin_ + 4, len);
+    begin_ += 4 + len;
+    scan_ = begin_;
+    if (begin_ == end_) begin_ = scan_ = end_ = 0;
+    return Status::Ready;
+}
+
+std::string LineReader::take_rest() {
+    std::string rest(buf_.data() + begin_, end_ - begin_);
+    begin_ = scan_ = end_ = 0;
+    return rest;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// ----------------------- Line reader -----------------------------
+// Per-connection read buffer. Bytes come off the socket in large
+// chunks, lines are found with memchr, and a partial line is carried
+// over until the rest of it arrives. The same buffer can also cut
+// length-prefixed binary frames. A line or frame longer than `max_line`
+// bytes is reported instead of being buffered without bound.
+
+class LineReader {
+public:
+    static const size_t CHUNK = 64 * 1024;
+
+    enum class Status { Ready, NeedMore, TooLong };
+
+    explicit LineReader(size_t max_line);
+
+    // One recv() of up to CHUNK bytes into the buffer. Same return
+    // convention as recv(): >0 bytes read, 0 on peer close, -1 with errno.
+    ssize_t fill(int fd);
+
+    // Moves the next complete line (without its '\n') into `line`.
+    Status next_line(std::string& line);
+
+    // Moves the next complete frame payload (4-byte big-endian length
+    // prefix stripped) into `payload`.
+    Status next_frame(std::string& payload);
+
+    // Whatever is left after the last newline; used at end of stream.
+    std::string take_rest();
+
+    size_t buffered() const { return end_ - begin_; }
+
+private:
+    std::vector<char> buf_;
+    size_t begin_ = 0;  // first unconsumed byte
+    size_t scan_ = 0;   // bytes before this are known to hold no '\n'
+    size_t end_ = 0;    // one past the last valid byte
+    size_t max_line_;
+};
@@ -1,313 +1,187 @@
-#include <arpa/inet.h>
-#include <fcntl.h>
-#include <netinet/in.h>
-#include <sys/socket.h>
-#include <unistd.h>
-
-#include <chrono>
+#include <atomic>
 #include <csignal>
-#include <cstring>
-#include <fstream>
-#include <functional>
+#include <exception>
+#include <cstdlib>
 #include <iostream>
-#include <mutex>
-#include <optional>
-#include <sstream>
 #include <string>
 #include <thread>
 #include <vector>
-#include <atomic>
 
-#include <nlohmann/json.hpp>
+#include <unistd.h>
 
-using json = nlohmann::json;
+#include "config.hpp"
+#include "metrics.hpp"
+#include "net.hpp"
+#include "reactor.hpp"
+#include "registry.hpp"
+#include "result_cache.hpp"
+#include "shared_process.hpp"
+#include "shm_transport.hpp"
+#include "snapshot.hpp"
+#include "worker_pool.hpp"
 
 // ----------------------- Config / defaults -----------------------
 
 static const char* DEFAULT_HOST = "0.0.0.0";
 static const int   DEFAULT_PORT = 11111;
-static const char* DEFAULT_CONFIG_PATH = "/config/config.json";
-static const char* FALLBACK_CONFIG_PATH = "config/default_config.json";
 
 static std::atomic<bool> RUNNING{true};
 
-// ----------------------- Process interface -----------------------
-
-struct Process {
-    virtual ~Process() = default;
-    virtual json inputs() const = 0;
-    virtual json outputs() const = 0;
-    virtual json update(const json& state, double interval) = 0;
-};
-
-// ----------------------- Example process -------------------------
-// CounterProcess: counter(t+dt) = counter(t) + rate * dt
-
-class CounterProcess : public Process {
-public:
-    explicit CounterProcess(double rate = 1.0) : rate_(rate) {}
-
-    json inputs() const override {
-        return json{
-            {"counter", {{"_type", "number"}}}
-        };
-    }
+void sigint_handler(int) {
+    RUNNING.store(false);
+}
 
-    json outputs() const override {
-        return json{
-            {"counter", {{"_type", "number"}, {"_apply", "set"}}}
-        };
-    }
+// ----------------------- main ------------------------------------
 
-    json update(const json& state, double interval) override {
-        double current = 0.0;
-        if (state.contains("counter")) {
-            try {
-                current = state.at("counter").get<double>();
-            } catch (...) {
-                current = 0.0;
-            }
-        }
-        double newval = current + rate_ * interval;
-        return json{{"counter", newval}};
-    }
+int main(int argc, char** argv) {
+    std::signal(SIGINT, sigint_handler);
+    std::signal(SIGTERM, sigint_handler);
+    std::signal(SIGPIPE, SIG_IGN);
 
-private:
-    double rate_;
-};
+    // env overrides
+    const char* port_env = std::getenv("PORT");
+    int port = port_env ? std::atoi(port_env) : DEFAULT_PORT;
 
-// ----------------------- Config helpers --------------------------
+    const char* host_env = std::getenv("HOST");
+    std::string host = host_env ? std::string(host_env) : std::string(DEFAULT_HOST);
 
-json read_json_file(const std::string& path) {
-    std::ifstream f(path);
-    if (!f) return json::object();
-    json j;
+    // load config & build the prototype every connection is cloned from
+    json cfg = read_config();
+    ServerOptions opts = read_server_options(cfg);
+    Metrics::instance().set_enabled(opts.metrics);
+    ResultCache::instance().set_capacity(opts.result_cache_entries);
+    std::unique_ptr<Process> prototype;
     try {
-        f >> j;
-    } catch (...) {
-        return json::object();
-    }
-    return j;
-}
-
-json read_config() {
-    const char* env_path = std::getenv("CONFIG_PATH");
-    std::string primary = env_path ? std::string(env_path) : std::string(DEFAULT_CONFIG_PATH);
-
-    // Try primary, else fallback
-    std::ifstream f1(primary);
-    if (f1.good()) {
-        return read_json_file(primary);
-    }
-    return read_json_file(FALLBACK_CONFIG_PATH);
-}
-
-std::unique_ptr<Process> build_process_from_config(const json& cfg) {
-    std::string pname = "counter";
-    if (cfg.contains("process")) {
-        try { pname = cfg.at("process").get<std::string>(); } catch (...) {}
+        prototype = build_process_from_config(cfg);
+    } catch (const std::exception& e) {
+        std::cerr << "Invalid process config: " << e.what() << "\n";
+        return 1;
     }
-
-    if (pname == "counter") {
-        double rate = 1.0;
-        if (cfg.contains("rate")) {
-            try { rate = cfg.at("rate").get<double>(); } catch (...) {}
+    if (!opts.restore_checkpoint.empty()) {
+        // Before sharing or cloning, so every connection starts from it.
+        try {
+            std::size_t bytes = load_checkpoint(
+                checkpoint_path(opts.checkpoint_dir.empty() ? "." : opts.checkpoint_dir,
+                                opts.restore_checkpoint),
+                *prototype, nullptr);
+            std::cout << "Restored checkpoint " << opts.restore_checkpoint << " (" << bytes << " bytes)\n";
+        } catch (const std::exception& e) {
+            std::cerr << "Cannot restore checkpoint: " << e.what() << "\n";
+            return 1;
         }
-        return std::make_unique<CounterProcess>(rate);
-    }
-
-    // default
-    return std::make_unique<CounterProcess>();
-}
-
-// ----------------------- Networking utils ------------------------
-
-int create_server_socket(const std::string& host, int port) {
-    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
-    if (fd < 0) {
-        perror("socket");
-        return -1;
     }
-
-    int opt = 1;
-    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-        perror("setsockopt SO_REUSEADDR");
-        ::close(fd);
-        return -1;
-    }
-
-    sockaddr_in addr{};
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port);
-    if (::inet_pton(AF_INET, host.c_str(), &addr.sin_addr) <= 0) {
-        perror("inet_pton");
-        ::close(fd);
-        return -1;
-    }
-
-    if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
-        perror("bind");
-        ::close(fd);
-        return -1;
+    if (prototype->concurrency() == Concurrency::ThreadAffine && !opts.share_process) {
+        // Per-connection instances run on whichever worker picks up the
+        // request; only the shared instance has a thread of its own.
+        std::cerr << "A thread-affine process needs server.share_process (SHARE_PROCESS=1)\n";
+        return 1;
     }
-
-    if (::listen(fd, 16) < 0) {
-        perror("listen");
-        ::close(fd);
-        return -1;
+    if (opts.share_process) {
+        // Connections then clone handles to this one instance.
+        prototype = SharedProcess::share(std::move(prototype));
     }
 
-    return fd;
-}
-
-std::optional<std::string> recv_line(int client_fd) {
-    std::string line;
-    char c;
-    while (true) {
-        ssize_t n = ::recv(client_fd, &c, 1, 0);
-        if (n == 0) {
-            // peer closed
-            if (line.empty()) return std::nullopt;
-            break;
+    // One listener per acceptor; with more than one they share the port
+    // through SO_REUSEPORT. The Unix socket, if any, goes to the first.
+    std::vector<std::vector<int>> listeners(opts.acceptors);
+    auto close_listeners = [&] {
+        for (auto& fds : listeners) {
+            for (int fd : fds) ::close(fd);
         }
-        if (n < 0) {
-            if (errno == EINTR) continue;
-            perror("recv");
-            return std::nullopt;
+    };
+    for (auto& fds : listeners) {
+        int server_fd = create_server_socket(host, port, opts.socket);
+        if (server_fd < 0) {
+            std::cerr << "Failed to start server\n";
+            close_listeners();
+            return 1;
         }
-        if (c == '\n') break;
-        line.push_back(c);
-    }
-    return line;
-}
-
-bool send_line(int client_fd, const std::string& s) {
-    std::string out = s;
-    out.push_back('\n');
-    const char* buf = out.c_str();
-    size_t total = 0;
-    size_t len = out.size();
-    while (total < len) {
-        ssize_t n = ::send(client_fd, buf + total, len - total, 0);
-        if (n < 0) {
-            if (errno == EINTR) continue;
-            perror("send");
-            return false;
+        fds.push_back(server_fd);
+    }
+    if (!opts.socket_path.empty()) {
+        int unix_fd = create_unix_server_socket(opts.socket_path, opts.socket);
+        if (unix_fd < 0) {
+            std::cerr << "Failed to listen on " << opts.socket_path << "\n";
+            close_listeners();
+            return 1;
         }
-        total += static_cast<size_t>(n);
+        listeners[0].push_back(unix_fd);
     }
-    return true;
-}
-
-// ----------------------- Command router --------------------------
 
-json run_command(const json& cmd, Process& process) {
-    if (!cmd.contains("command")) {
-        return json{{"error", "missing 'command' field"}};
-    }
-    std::string cname;
-    try {
-        cname = cmd.at("command").get<std::string>();
-    } catch (...) {
-        return json{{"error", "invalid 'command' field"}};
-    }
+    WorkerPool pool(opts.workers);
 
-    if (cname == "inputs") {
-        return process.inputs();
-    } else if (cname == "outputs") {
-        return process.outputs();
-    } else if (cname == "update") {
-        json args = json::object();
-        if (cmd.contains("arguments")) {
-            try { args = cmd.at("arguments"); } catch (...) {}
+    // Each connection gets its own copy of the prototype (or a handle to
+    // it, in shared mode).
+    auto factory = [&] { return instantiate_process(*prototype, cfg); };
+    std::vector<std::unique_ptr<Reactor>> reactors;
+    for (auto& fds : listeners) {
+        reactors.push_back(std::make_unique<Reactor>(fds, opts, pool, factory));
+        if (!reactors.back()->ok()) {
+            std::cerr << "Failed to start event loop\n";
+            close_listeners();
+            return 1;
         }
-        json state = args.value("state", json::object());
-        double interval = 0.0;
-        try {
-            interval = args.at("interval").get<double>();
-        } catch (...) {
-            interval = 0.0;
-        }
-        return process.update(state, interval);
-    } else {
-        return json{{"error", std::string("unknown command: ") + cname}};
     }
-}
 
-void handle_client(int client_fd, std::unique_ptr<Process> process) {
-    while (RUNNING.load()) {
-        auto maybe_line = recv_line(client_fd);
-        if (!maybe_line.has_value()) break;
-        std::string line = *maybe_line;
-
-        // ignore empty lines
-        if (line.find_first_not_of(" \t\r") == std::string::npos) {
-            continue;
+    std::unique_ptr<ShmServer> shm;
+    if (!opts.shm_name.empty()) {
+        shm = std::make_unique<ShmServer>(opts.shm_name, opts.shm_bytes, opts.protocol, pool, factory,
+                                          opts.drain_timeout_ms, opts.checkpoint_dir);
+        if (!shm->start(RUNNING)) {
+            std::cerr << "Failed to create shared memory " << opts.shm_name << "\n";
+            close_listeners();
+            return 1;
         }
-
-        json cmd;
-        try {
-            cmd = json::parse(line);
-        } catch (...) {
-            send_line(client_fd, json{{"error", "invalid json"}}.dump());
-            continue;
-        }
-
-        json result = run_command(cmd, *process);
-        send_line(client_fd, result.dump());
     }
-    ::close(client_fd);
-}
 
-void sigint_handler(int) {
-    RUNNING.store(false);
-}
-
-// ----------------------- main ------------------------------------
-
-int main(int argc, char** argv) {
-    std::signal(SIGINT, sigint_handler);
-    std::signal(SIGTERM, sigint_handler);
-
-    // env overrides
-    const char* port_env = std::getenv("PORT");
-    int port = port_env ? std::atoi(port_env) : DEFAULT_PORT;
-
-    const char* host_env = std::getenv("HOST");
-    std::string host = host_env ? std::string(host_env) : std::string(DEFAULT_HOST);
-
-    // load config & build process
-    json cfg = read_config();
-    auto process = build_process_from_config(cfg);
-
-    int server_fd = create_server_socket(host, port);
-    if (server_fd < 0) {
-        std::cerr << "Failed to start server\n";
+    MetricsEndpoint metrics_endpoint;
+    if (opts.metrics_port > 0 && !metrics_endpoint.start(host, opts.metrics_port, RUNNING)) {
+        std::cerr << "Failed to serve metrics on port " << opts.metrics_port << "\n";
+        RUNNING.store(false);  // lets the shared-memory thread finish
+        if (shm) shm->stop();
+        close_listeners();
         return 1;
     }
-    std::cout << "process is listening on " << host << ":" << port << std::endl;
-
-    std::vector<std::thread> workers;
-    while (RUNNING.load()) {
-        sockaddr_in client_addr{};
-        socklen_t len = sizeof(client_addr);
-        int client_fd = ::accept(server_fd, reinterpret_cast<sockaddr*>(&client_addr), &len);
-        if (client_fd < 0) {
-            if (errno == EINTR) continue;
-            perror("accept");
-            break;
-        }
-
-        // Create a fresh process instance per connection if desired,
-        // or share one across connections. Here, we clone by rebuilding.
-        auto per_conn_proc = build_process_from_config(cfg);
-
-        workers.emplace_back(std::thread([client_fd, p = std::move(per_conn_proc)]() mutable {
-            handle_client(client_fd, std::move(p));
-        }));
-        workers.back().detach(); // detach to avoid joining on shutdown
-    }
 
-    ::close(server_fd);
+    std::cout << "process is listening on " << host << ":" << port;
+    if (!opts.socket_path.empty()) std::cout << " and " << opts.socket_path;
+    if (shm) std::cout << ", shared memory " << opts.shm_name;
+    if (opts.metrics_port > 0) std::cout << ", metrics on port " << opts.metrics_port;
+    std::cout << " (" << reactors.size() << " acceptors, " << pool.size() << " workers)" << std::endl;
+
+    // The first event loop runs on this thread, the others on their own.
+    std::vector<std::thread> loops;
+    for (size_t i = 1; i < reactors.size(); ++i) {
+        loops.emplace_back([&reactor = *reactors[i]] { reactor.run(RUNNING); });
+    }
+    reactors[0]->run(RUNNING);
+    // Every loop returns once it has drained its connections or hit the
+    // deadline; see Reactor::drain_connections().
+    for (auto& loop : loops) loop.join();
+    if (shm) shm->stop();
+    metrics_endpoint.stop();
+
+    // Let workers finish what they already picked up before the reactors
+    // close the client sockets underneath them.
+    pool.shutdown();
+
+    DrainReport total;
+    auto add = [&total](const DrainReport& r) {
+        total.connections += r.connections;
+        total.requests += r.requests;
+        total.completed += r.completed;
+        total.abandoned += r.abandoned;
+    };
+    for (auto& reactor : reactors) add(reactor->drain_report());
+    if (shm) add(shm->drain_report());
+    std::cout << "shutdown: drained " << total.connections - total.abandoned << " of "
+              << total.connections << " connections, answered " << total.completed << " of "
+              << total.requests << " queued requests";
+    if (total.abandoned > 0) std::cout << " (" << total.abandoned << " closed at the deadline)";
+    std::cout << std::endl;
+    reactors.clear();
+
+    close_listeners();
+    if (!opts.socket_path.empty()) ::unlink(opts.socket_path.c_str());
     return 0;
 }
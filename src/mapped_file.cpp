@@ -0,0 +1,41 @@
+#include "mapped_file.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static std::runtime_error mapping_error(const char* what, const std::string& path) {
+    return std::runtime_error(std::string(what) + " " + path + ": " + std::strerror(errno));
+}
+
+MappedFile::MappedFile(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) throw mapping_error("cannot open", path);
+    struct stat st{};
+    if (::fstat(fd, &st) != 0) {
+        std::runtime_error error = mapping_error("cannot stat", path);
+        ::close(fd);
+        throw error;
+    }
+    size_ = static_cast<std::size_t>(st.st_size);
+    if (size_ > 0) {
+        void* data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            std::runtime_error error = mapping_error("cannot map", path);
+            ::close(fd);
+            throw error;
+        }
+        data_ = static_cast<const char*>(data);
+    }
+    // The mapping keeps the file alive on its own.
+    ::close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (data_) ::munmap(const_cast<char*>(data_), size_);
+}
@@ -0,0 +1,462 @@
+#include "metrics.hpp"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+#include "net.hpp"
+#include "pool_allocator.hpp"
+
+static const int SUB_BITS = 4;               // 16 sub-buckets per power of two
+static const int SUB_BUCKETS = 1 << SUB_BITS;
+static const int MAX_EXPONENT = 40;          // 2^40 ns, about 18 minutes
+static const size_t BUCKETS = (MAX_EXPONENT - SUB_BITS + 2) * SUB_BUCKETS;
+static const int POLL_MS = 200;              // how often the endpoint re-checks `running`
+static const size_t MAX_HTTP_REQUEST = 8192;
+
+static const size_t COMMAND_KINDS = static_cast<size_t>(CommandKind::Count);
+static const size_t STAGES = static_cast<size_t>(Stage::Count);
+static const size_t SHED_REASONS = static_cast<size_t>(Shed::Count);
+
+// Prometheus bucket bounds: every other power of two from 2^10 ns
+// (about 1 us) to 2^34 ns (about 17 s). Powers of two are bucket edges
+// of the fine histogram, so the cumulative counts are exact.
+static const int PROM_FIRST_EXPONENT = 10;
+static const int PROM_LAST_EXPONENT = 34;
+static const int PROM_EXPONENT_STEP = 2;
+
+CommandKind command_kind(const std::string& name) {
+    if (name == "update") return CommandKind::Update;
+    if (name == "update_batch") return CommandKind::UpdateBatch;
+    if (name == "update_columns") return CommandKind::UpdateColumns;
+    if (name == "inputs") return CommandKind::Inputs;
+    if (name == "outputs") return CommandKind::Outputs;
+    if (name == "run") return CommandKind::Run;
+    if (name == "reset_state") return CommandKind::ResetState;
+    if (name == "checkpoint") return CommandKind::Checkpoint;
+    if (name == "restore") return CommandKind::Restore;
+    if (name == "metrics") return CommandKind::Metrics;
+    return CommandKind::Other;
+}
+
+const char* command_kind_name(CommandKind kind) {
+    switch (kind) {
+    case CommandKind::Inputs:      return "inputs";
+    case CommandKind::Outputs:     return "outputs";
+    case CommandKind::Update:      return "update";
+    case CommandKind::UpdateBatch: return "update_batch";
+    case CommandKind::UpdateColumns: return "update_columns";
+    case CommandKind::Run:         return "run";
+    case CommandKind::ResetState:  return "reset_state";
+    case CommandKind::Checkpoint:  return "checkpoint";
+    case CommandKind::Restore:     return "restore";
+    case CommandKind::Metrics:     return "metrics";
+    case CommandKind::Other:
+    case CommandKind::Count:       break;
+    }
+    return "other";
+}
+
+const char* stage_name(Stage stage) {
+    switch (stage) {
+    case Stage::Read:      return "read";
+    case Stage::Parse:     return "parse";
+    case Stage::Serialize: return "serialize";
+    case Stage::Send:      return "send";
+    case Stage::Count:     break;
+    }
+    return "unknown";
+}
+
+const char* shed_name(Shed reason) {
+    switch (reason) {
+    case Shed::Connection: return "connections";
+    case Shed::RateLimit:  return "rate_limit";
+    case Shed::Overload:   return "overload";
+    case Shed::Count:      break;
+    }
+    return "unknown";
+}
+
+// ---- Histogram buckets ----
+// Values below 16 ns get one bucket each; above that, bucket
+// (e - 3) * 16 + s holds [(16 + s) << (e - 4), (17 + s) << (e - 4))
+// where e is the position of the value's top bit.
+
+static size_t bucket_index(uint64_t ns) {
+    if (ns < static_cast<uint64_t>(SUB_BUCKETS)) return static_cast<size_t>(ns);
+    int e = 63 - __builtin_clzll(ns);
+    if (e > MAX_EXPONENT) return BUCKETS - 1;
+    size_t sub = static_cast<size_t>(ns >> (e - SUB_BITS)) & (SUB_BUCKETS - 1);
+    return static_cast<size_t>(e - SUB_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+static uint64_t bucket_lower(size_t index) {
+    if (index < static_cast<size_t>(SUB_BUCKETS)) return index;
+    int e = static_cast<int>(index / SUB_BUCKETS) + SUB_BITS - 1;
+    uint64_t sub = index % SUB_BUCKETS;
+    return (SUB_BUCKETS + sub) << (e - SUB_BITS);
+}
+
+static uint64_t bucket_middle(size_t index) {
+    if (index < static_cast<size_t>(SUB_BUCKETS)) return index;
+    int e = static_cast<int>(index / SUB_BUCKETS) + SUB_BITS - 1;
+    return bucket_lower(index) + (uint64_t(1) << (e - SUB_BITS)) / 2;
+}
+
+// ---- Per-thread shards ----
+
+// Only the owning thread writes, so a relaxed load and store is enough
+// and avoids a locked read-modify-write; readers may see a slightly
+// stale value.
+static inline void bump(std::atomic<uint64_t>& counter, uint64_t by = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+}
+
+struct Histogram {
+    std::array<std::atomic<uint64_t>, BUCKETS> buckets{};
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sum_ns{0};
+    std::atomic<uint64_t> max_ns{0};
+
+    void record(uint64_t ns) {
+        bump(buckets[bucket_index(ns)]);
+        bump(count);
+        bump(sum_ns, ns);
+        if (ns > max_ns.load(std::memory_order_relaxed)) max_ns.store(ns, std::memory_order_relaxed);
+    }
+};
+
+struct Shard {
+    std::array<Histogram, COMMAND_KINDS> commands;
+    std::array<std::atomic<uint64_t>, COMMAND_KINDS> errors{};
+    std::array<Histogram, STAGES> stages;
+    std::atomic<uint64_t> bytes_in{0};
+    std::atomic<uint64_t> bytes_out{0};
+    std::atomic<uint64_t> accepted{0};
+    std::atomic<uint64_t> cache_hits{0};
+    std::atomic<uint64_t> cache_misses{0};
+    std::array<std::atomic<uint64_t>, SHED_REASONS> shed{};
+};
+
+// Shards outlive their threads so nothing recorded is lost when a
+// thread exits.
+static std::mutex SHARDS_MU;
+static std::vector<std::unique_ptr<Shard>> SHARDS;
+
+static Shard& local_shard() {
+    thread_local Shard* shard = [] {
+        auto owned = std::make_unique<Shard>();
+        Shard* raw = owned.get();
+        std::lock_guard<std::mutex> lock(SHARDS_MU);
+        SHARDS.push_back(std::move(owned));
+        return raw;
+    }();
+    return *shard;
+}
+
+// A histogram summed over all shards.
+struct Totals {
+    std::vector<uint64_t> buckets = std::vector<uint64_t>(BUCKETS, 0);
+    uint64_t count = 0;
+    uint64_t sum_ns = 0;
+    uint64_t max_ns = 0;
+
+    void add(const Histogram& h) {
+        for (size_t i = 0; i < BUCKETS; ++i) buckets[i] += h.buckets[i].load(std::memory_order_relaxed);
+        count += h.count.load(std::memory_order_relaxed);
+        sum_ns += h.sum_ns.load(std::memory_order_relaxed);
+        max_ns = std::max(max_ns, h.max_ns.load(std::memory_order_relaxed));
+    }
+
+    // Buckets and count are read separately, so anything derived from the
+    // buckets goes by their sum rather than by `count`.
+    uint64_t bucketed() const {
+        uint64_t total = 0;
+        for (uint64_t c : buckets) total += c;
+        return total;
+    }
+
+    uint64_t quantile_ns(double q) const {
+        uint64_t total = bucketed();
+        if (total == 0) return 0;
+        uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(total - 1)) + 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            seen += buckets[i];
+            if (seen >= rank) return std::min(bucket_middle(i), max_ns);
+        }
+        return max_ns;
+    }
+
+    // Values strictly below `bound`, which must be a bucket edge.
+    uint64_t below(uint64_t bound) const {
+        uint64_t n = 0;
+        for (size_t i = 0, end = bucket_index(bound); i < end; ++i) n += buckets[i];
+        return n;
+    }
+
+    json summary() const {
+        auto us = [](uint64_t ns) { return static_cast<double>(ns) / 1000.0; };
+        return json{
+            {"count", count},
+            {"mean_us", count ? us(sum_ns) / static_cast<double>(count) : 0.0},
+            {"p50_us", us(quantile_ns(0.50))},
+            {"p90_us", us(quantile_ns(0.90))},
+            {"p99_us", us(quantile_ns(0.99))},
+            {"p999_us", us(quantile_ns(0.999))},
+            {"max_us", us(max_ns)},
+        };
+    }
+};
+
+struct Collected {
+    std::vector<Totals> commands = std::vector<Totals>(COMMAND_KINDS);
+    std::vector<uint64_t> errors = std::vector<uint64_t>(COMMAND_KINDS, 0);
+    std::vector<Totals> stages = std::vector<Totals>(STAGES);
+    uint64_t bytes_in = 0;
+    uint64_t bytes_out = 0;
+    uint64_t accepted = 0;
+    uint64_t cache_hits = 0;
+    uint64_t cache_misses = 0;
+    std::vector<uint64_t> shed = std::vector<uint64_t>(SHED_REASONS, 0);
+};
+
+static Collected collect() {
+    Collected c;
+    std::lock_guard<std::mutex> lock(SHARDS_MU);
+    for (const auto& shard : SHARDS) {
+        for (size_t k = 0; k < COMMAND_KINDS; ++k) {
+            c.commands[k].add(shard->commands[k]);
+            c.errors[k] += shard->errors[k].load(std::memory_order_relaxed);
+        }
+        for (size_t s = 0; s < STAGES; ++s) c.stages[s].add(shard->stages[s]);
+        c.bytes_in += shard->bytes_in.load(std::memory_order_relaxed);
+        c.bytes_out += shard->bytes_out.load(std::memory_order_relaxed);
+        c.accepted += shard->accepted.load(std::memory_order_relaxed);
+        c.cache_hits += shard->cache_hits.load(std::memory_order_relaxed);
+        c.cache_misses += shard->cache_misses.load(std::memory_order_relaxed);
+        for (size_t r = 0; r < SHED_REASONS; ++r) c.shed[r] += shard->shed[r].load(std::memory_order_relaxed);
+    }
+    return c;
+}
+
+// ---- Metrics ----
+
+Metrics& Metrics::instance() {
+    static Metrics metrics;
+    return metrics;
+}
+
+Metrics::Metrics() : started_ns_(metrics_now_ns()) {}
+
+void Metrics::record_command(CommandKind kind, uint64_t ns, bool error) {
+    if (!enabled()) return;
+    Shard& shard = local_shard();
+    size_t k = static_cast<size_t>(kind);
+    shard.commands[k].record(ns);
+    if (error) bump(shard.errors[k]);
+}
+
+void Metrics::record_stage(Stage stage, uint64_t ns) {
+    if (!enabled()) return;
+    local_shard().stages[static_cast<size_t>(stage)].record(ns);
+}
+
+void Metrics::add_bytes_in(size_t n) {
+    if (enabled()) bump(local_shard().bytes_in, n);
+}
+
+void Metrics::add_bytes_out(size_t n) {
+    if (enabled()) bump(local_shard().bytes_out, n);
+}
+
+void Metrics::record_result_cache(bool hit) {
+    if (!enabled()) return;
+    Shard& shard = local_shard();
+    bump(hit ? shard.cache_hits : shard.cache_misses);
+}
+
+void Metrics::record_shed(Shed reason) {
+    if (enabled()) bump(local_shard().shed[static_cast<size_t>(reason)]);
+}
+
+void Metrics::connection_opened() {
+    open_connections_.fetch_add(1, std::memory_order_relaxed);
+    bump(local_shard().accepted);
+}
+
+void Metrics::connection_closed() {
+    open_connections_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+json Metrics::snapshot() const {
+    Collected c = collect();
+    json commands = json::object();
+    for (size_t k = 0; k < COMMAND_KINDS; ++k) {
+        if (c.commands[k].count == 0) continue;
+        json entry = c.commands[k].summary();
+        entry["errors"] = c.errors[k];
+        commands[command_kind_name(static_cast<CommandKind>(k))] = std::move(entry);
+    }
+    json stages = json::object();
+    for (size_t s = 0; s < STAGES; ++s) {
+        if (c.stages[s].count == 0) continue;
+        stages[stage_name(static_cast<Stage>(s))] = c.stages[s].summary();
+    }
+    json shed = json::object();
+    for (size_t r = 0; r < SHED_REASONS; ++r) shed[shed_name(static_cast<Shed>(r))] = c.shed[r];
+    return json{
+        {"uptime_seconds", static_cast<double>(metrics_now_ns() - started_ns_) / 1e9},
+        {"connections", {{"open", open_connections_.load(std::memory_order_relaxed)},
+                         {"accepted", c.accepted}}},
+        {"bytes", {{"in", c.bytes_in}, {"out", c.bytes_out}}},
+        {"allocator", {{"heap_allocations", pool_heap_allocations()}}},
+        {"result_cache", {{"hits", c.cache_hits}, {"misses", c.cache_misses}}},
+        {"shed", std::move(shed)},
+        {"commands", std::move(commands)},
+        {"stages", std::move(stages)},
+    };
+}
+
+static void write_histogram(std::ostringstream& out, const char* metric, const char* label,
+                            const char* value, const Totals& t) {
+    // +Inf and _count must not fall below a finite bucket.
+    const uint64_t total = t.bucketed();
+    for (int e = PROM_FIRST_EXPONENT; e <= PROM_LAST_EXPONENT; e += PROM_EXPONENT_STEP) {
+        uint64_t bound = uint64_t(1) << e;
+        out << metric << "_bucket{" << label << "=\"" << value << "\",le=\""
+            << static_cast<double>(bound) / 1e9 << "\"} " << t.below(bound) << "\n";
+    }
+    out << metric << "_bucket{" << label << "=\"" << value << "\",le=\"+Inf\"} " << total << "\n";
+    out << metric << "_sum{" << label << "=\"" << value << "\"} "
+        << static_cast<double>(t.sum_ns) / 1e9 << "\n";
+    out << metric << "_count{" << label << "=\"" << value << "\"} " << total << "\n";
+}
+
+std::string Metrics::prometheus() const {
+    Collected c = collect();
+    std::ostringstream out;
+
+    out << "# HELP vivarium_command_duration_seconds Time spent running a command.\n"
+        << "# TYPE vivarium_command_duration_seconds histogram\n";
+    for (size_t k = 0; k < COMMAND_KINDS; ++k) {
+        if (c.commands[k].count == 0) continue;
+        write_histogram(out, "vivarium_command_duration_seconds", "command",
+                        command_kind_name(static_cast<CommandKind>(k)), c.commands[k]);
+    }
+    out << "# HELP vivarium_command_errors_total Commands answered with an error.\n"
+        << "# TYPE vivarium_command_errors_total counter\n";
+    for (size_t k = 0; k < COMMAND_KINDS; ++k) {
+        if (c.commands[k].count == 0) continue;
+        out << "vivarium_command_errors_total{command=\""
+            << command_kind_name(static_cast<CommandKind>(k)) << "\"} " << c.errors[k] << "\n";
+    }
+    out << "# HELP vivarium_stage_duration_seconds Time spent in each stage of the request path.\n"
+        << "# TYPE vivarium_stage_duration_seconds histogram\n";
+    for (size_t s = 0; s < STAGES; ++s) {
+        if (c.stages[s].count == 0) continue;
+        write_histogram(out, "vivarium_stage_duration_seconds", "stage",
+                        stage_name(static_cast<Stage>(s)), c.stages[s]);
+    }
+    out << "# HELP vivarium_connections_open Client connections currently open.\n"
+        << "# TYPE vivarium_connections_open gauge\n"
+        << "vivarium_connections_open " << open_connections_.load(std::memory_order_relaxed) << "\n"
+        << "# HELP vivarium_connections_accepted_total Client connections accepted.\n"
+        << "# TYPE vivarium_connections_accepted_total counter\n"
+        << "vivarium_connections_accepted_total " << c.accepted << "\n"
+        << "# HELP vivarium_bytes_received_total Request bytes received.\n"
+        << "# TYPE vivarium_bytes_received_total counter\n"
+        << "vivarium_bytes_received_total " << c.bytes_in << "\n"
+        << "# HELP vivarium_bytes_sent_total Reply bytes sent.\n"
+        << "# TYPE vivarium_bytes_sent_total counter\n"
+        << "vivarium_bytes_sent_total " << c.bytes_out << "\n"
+        << "# HELP vivarium_result_cache_hits_total Updates answered from the result cache.\n"
+        << "# TYPE vivarium_result_cache_hits_total counter\n"
+        << "vivarium_result_cache_hits_total " << c.cache_hits << "\n"
+        << "# HELP vivarium_result_cache_misses_total Cacheable updates that had to run.\n"
+        << "# TYPE vivarium_result_cache_misses_total counter\n"
+        << "vivarium_result_cache_misses_total " << c.cache_misses << "\n"
+        << "# HELP vivarium_shed_total Connections and requests turned away by admission control.\n"
+        << "# TYPE vivarium_shed_total counter\n";
+    for (size_t r = 0; r < SHED_REASONS; ++r) {
+        out << "vivarium_shed_total{reason=\"" << shed_name(static_cast<Shed>(r)) << "\"} " << c.shed[r] << "\n";
+    }
+    return out.str();
+}
+
+// ---- Prometheus endpoint ----
+
+MetricsEndpoint::~MetricsEndpoint() {
+    stop();
+}
+
+bool MetricsEndpoint::start(const std::string& host, int port, const std::atomic<bool>& running) {
+    listen_fd_ = create_server_socket(host, port);
+    if (listen_fd_ < 0) return false;
+    thread_ = std::thread([this, &running] { serve(running); });
+    return true;
+}
+
+void MetricsEndpoint::stop() {
+    if (thread_.joinable()) thread_.join();
+    if (listen_fd_ >= 0) {
+        ::close(listen_fd_);
+        listen_fd_ = -1;
+    }
+}
+
+void MetricsEndpoint::serve(const std::atomic<bool>& running) {
+    while (running.load()) {
+        pollfd p{listen_fd_, POLLIN, 0};
+        int n = ::poll(&p, 1, POLL_MS);
+        if (n <= 0) continue;
+        int client_fd = ::accept(listen_fd_, nullptr, nullptr);
+        if (client_fd < 0) {
+            if (errno != EINTR) perror("accept metrics");
+            continue;
+        }
+        answer(client_fd);
+        ::close(client_fd);
+    }
+}
+
+// Scrapes are rare and tiny, so one at a time with blocking I/O is plenty.
+void MetricsEndpoint::answer(int client_fd) {
+    std::string request;
+    char buf[1024];
+    while (request.size() < MAX_HTTP_REQUEST && request.find("\r\n\r\n") == std::string::npos) {
+        pollfd p{client_fd, POLLIN, 0};
+        if (::poll(&p, 1, POLL_MS) <= 0) return;
+        ssize_t n = ::recv(client_fd, buf, sizeof(buf), 0);
+        if (n <= 0) return;
+        request.append(buf, static_cast<size_t>(n));
+    }
+
+    std::string body;
+    std::string status = "200 OK";
+    if (request.compare(0, 4, "GET ") == 0) {
+        body = Metrics::instance().prometheus();
+    } else {
+        status = "405 Method Not Allowed";
+    }
+    std::string response = "HTTP/1.0 " + status +
+                           "\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                           std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+    size_t off = 0;
+    while (off < response.size()) {
+        ssize_t n = ::send(client_fd, response.data() + off, response.size() - off, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+        off += static_cast<size_t>(n);
+    }
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+#include "process.hpp"
+
+// ----------------------- Metrics ---------------------------------
+// Counters and latency histograms for the request path. Every thread
+// records into its own shard with plain relaxed stores, so recording
+// never contends; a snapshot sums the shards. Histograms are log-linear
+// in the HDR style: 16 sub-buckets per power of two of nanoseconds,
+// which keeps every bucket within about 6% of its value.
+//
+// Read them with {"command":"metrics"} or, with server.metrics_port set,
+// in the Prometheus text format over HTTP.
+
+enum class CommandKind { Inputs, Outputs, Update, UpdateBatch, UpdateColumns, Run, ResetState, Checkpoint,
+                         Restore, Metrics, Other, Count };
+enum class Stage { Read, Parse, Serialize, Send, Count };
+// Why admission control turned something away (admission.hpp).
+enum class Shed { Connection, RateLimit, Overload, Count };
+
+CommandKind command_kind(const std::string& name);
+const char* command_kind_name(CommandKind kind);
+const char* stage_name(Stage stage);
+const char* shed_name(Shed reason);
+
+inline uint64_t metrics_now_ns() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     std::chrono::steady_clock::now().time_since_epoch())
+                                     .count());
+}
+
+class Metrics {
+public:
+    static Metrics& instance();
+
+    // Recording can be switched off (server.metrics / METRICS); the
+    // metrics command then reports whatever was collected until then.
+    bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+    void set_enabled(bool on) { enabled_.store(on, std::memory_order_relaxed); }
+
+    void record_command(CommandKind kind, uint64_t ns, bool error);
+    void record_stage(Stage stage, uint64_t ns);
+    void add_bytes_in(size_t n);
+    void add_bytes_out(size_t n);
+    // One lookup in the result cache (result_cache.hpp).
+    void record_result_cache(bool hit);
+    // A connection or request turned away by admission control.
+    void record_shed(Shed reason);
+
+    void connection_opened();
+    void connection_closed();
+
+    // {"uptime_seconds", "connections", "bytes", "allocator",
+    // "result_cache", "shed", "commands", "stages"}; commands and stages that never ran are left out.
+    json snapshot() const;
+    std::string prometheus() const;
+
+private:
+    Metrics();
+
+    std::atomic<bool> enabled_{true};
+    std::atomic<int64_t> open_connections_{0};
+    uint64_t started_ns_;
+};
+
+// Records the time from construction to destruction as one stage.
+class StageTimer {
+public:
+    explicit StageTimer(Stage stage)
+        : stage_(stage), start_(Metrics::instance().enabled() ? metrics_now_ns() : 0) {}
+    ~StageTimer() {
+        if (start_) Metrics::instance().record_stage(stage_, metrics_now_ns() - start_);
+    }
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+private:
+    Stage stage_;
+    uint64_t start_;
+};
+
+// Serves Metrics::prometheus() to any HTTP GET on its own thread.
+class MetricsEndpoint {
+public:
+    MetricsEndpoint() = default;
+    ~MetricsEndpoint();
+
+    MetricsEndpoint(const MetricsEndpoint&) = delete;
+    MetricsEndpoint& operator=(const MetricsEndpoint&) = delete;
+
+    bool start(const std::string& host, int port, const std::atomic<bool>& running);
+    void stop();
+
+private:
+    void serve(const std::atomic<bool>& running);
+    void answer(int client_fd);
+
+    int listen_fd_ = -1;
+    std::thread thread_;
+};
@@ -0,0 +1,146 @@
+#include "net.hpp"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+int create_server_socket(const std::string& host, int port, const SocketOptions& opts) {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    int opt = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+        perror("setsockopt SO_REUSEADDR");
+        ::close(fd);
+        return -1;
+    }
+    if (opts.reuse_port && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        perror("setsockopt SO_REUSEPORT");
+        ::close(fd);
+        return -1;
+    }
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (::inet_pton(AF_INET, host.c_str(), &addr.sin_addr) <= 0) {
+        perror("inet_pton");
+        ::close(fd);
+        return -1;
+    }
+
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        perror("bind");
+        ::close(fd);
+        return -1;
+    }
+
+    if (::listen(fd, opts.backlog) < 0) {
+        perror("listen");
+        ::close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int create_unix_server_socket(const std::string& path, const SocketOptions& opts) {
+    sockaddr_un addr{};
+    if (path.size() >= sizeof(addr.sun_path)) {
+        std::fprintf(stderr, "socket path too long: %s\n", path.c_str());
+        return -1;
+    }
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket AF_UNIX");
+        return -1;
+    }
+
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    ::unlink(path.c_str());  // a stale socket from an earlier run
+
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        perror("bind AF_UNIX");
+        ::close(fd);
+        return -1;
+    }
+
+    if (::listen(fd, opts.backlog) < 0) {
+        perror("listen");
+        ::close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+void tune_client_socket(int fd, const SocketOptions& opts, bool tcp) {
+    // Failures here only cost performance, so they are reported and ignored.
+    int one = 1;
+    if (tcp && opts.tcp_nodelay && setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0) {
+        perror("setsockopt TCP_NODELAY");
+    }
+    if (opts.send_buffer > 0 &&
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &opts.send_buffer, sizeof(opts.send_buffer)) < 0) {
+        perror("setsockopt SO_SNDBUF");
+    }
+    if (opts.recv_buffer > 0 &&
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &opts.recv_buffer, sizeof(opts.recv_buffer)) < 0) {
+        perror("setsockopt SO_RCVBUF");
+    }
+}
+
+bool is_tcp_socket(int fd) {
+    int domain = 0;
+    socklen_t len = sizeof(domain);
+    if (getsockopt(fd, SOL_SOCKET, SO_DOMAIN, &domain, &len) < 0) return false;
+    return domain == AF_INET || domain == AF_INET6;
+}
+
+bool set_nonblocking(int fd) {
+    int flags = ::fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || ::fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        perror("fcntl O_NONBLOCK");
+        return false;
+    }
+    return true;
+}
+
+std::optional<std::string> recv_line(int client_fd, LineReader& reader) {
+    std::string line;
+    while (true) {
+        switch (reader.next_line(line)) {
+        case LineReader::Status::Ready:
+            return line;
+        case LineReader::Status::TooLong:
+            return std::nullopt;
+        case LineReader::Status::NeedMore:
+            break;
+        }
+
+        ssize_t n = reader.fill(client_fd);
+        if (n == 0) {
+            // peer closed
+            if (reader.buffered() == 0) return std::nullopt;
+            return reader.take_rest();
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("recv");
+            return std::nullopt;
+        }
+    }
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <optional>
+#include <string>
+
+#include "line_reader.hpp"
+
+// ----------------------- Networking utils ------------------------
+
+// Socket tuning, part of ServerOptions. Buffer sizes of 0 keep the
+// kernel's defaults.
+struct SocketOptions {
+    int backlog = 1024;       // BACKLOG, pending connections per listener
+    bool tcp_nodelay = true;  // TCP_NODELAY on client sockets
+    int send_buffer = 0;      // SEND_BUFFER, SO_SNDBUF on client sockets
+    int recv_buffer = 0;      // RECV_BUFFER, SO_RCVBUF on client sockets
+    bool reuse_port = false;  // REUSE_PORT, SO_REUSEPORT on the TCP listener
+};
+
+int create_server_socket(const std::string& host, int port, const SocketOptions& opts = {});
+// Listens on a Unix domain socket at `path`, replacing a stale one.
+int create_unix_server_socket(const std::string& path, const SocketOptions& opts = {});
+// Applies the client-side options to an accepted socket; TCP_NODELAY
+// only when `tcp`.
+void tune_client_socket(int fd, const SocketOptions& opts, bool tcp);
+bool is_tcp_socket(int fd);
+bool set_nonblocking(int fd);
+
+// Blocking read of the next line. Returns nullopt on close, error, or a
+// line longer than the reader's limit.
+std::optional<std::string> recv_line(int client_fd, LineReader& reader);
@@ -0,0 +1,190 @@
+#include "ode_process.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+#include "cancel.hpp"
+
+static const std::size_t CANCEL_CHECK_STEPS = 256;  // steps between looks at the cancel token
+static const double SAFETY = 0.9;                   // adaptive: fraction of the predicted step
+static const double MIN_GROWTH = 0.2;               // adaptive: bounds on step size change
+static const double MAX_GROWTH = 5.0;
+
+// ---- Options ----
+
+static Integrator parse_method(const std::string& name) {
+    if (name == "euler") return Integrator::Euler;
+    if (name == "rk4") return Integrator::Rk4;
+    if (name == "adaptive") return Integrator::Adaptive;
+    throw std::invalid_argument("unknown integrator '" + name + "' (expected euler, rk4 or adaptive)");
+}
+
+IntegratorOptions IntegratorOptions::from_config(const json& cfg) {
+    IntegratorOptions options;
+    auto it = cfg.is_object() ? cfg.find("integrator") : cfg.end();
+    if (it == cfg.end()) return options;
+    if (it->is_string()) {
+        options.method = parse_method(it->get<std::string>());
+        return options;
+    }
+    if (!it->is_object()) throw std::invalid_argument("'integrator' must be a method name or an object");
+    try {
+        const json& section = *it;
+        if (section.contains("method")) options.method = parse_method(section.at("method").get<std::string>());
+        options.substeps = section.value("substeps", options.substeps);
+        options.rtol = section.value("rtol", options.rtol);
+        options.atol = section.value("atol", options.atol);
+        options.max_steps = section.value("max_steps", options.max_steps);
+    } catch (const json::exception& e) {
+        throw std::invalid_argument(std::string("bad 'integrator' value: ") + e.what());
+    }
+    if (options.substeps == 0) throw std::invalid_argument("integrator substeps must be at least 1");
+    if (!(options.rtol >= 0.0) || !(options.atol >= 0.0) || options.rtol + options.atol <= 0.0) {
+        throw std::invalid_argument("integrator tolerances must be non-negative and not both zero");
+    }
+    return options;
+}
+
+// ---- Steppers ----
+// Both advance `y` in place and use `work` (WORK_SLOTS values per state
+// slot) for their stages.
+
+static const std::size_t WORK_SLOTS = 8;
+
+static void fixed_steps(const OdeProcess& ode, double* y, double* work, std::size_t n, double interval,
+                        Integrator method, std::size_t steps) {
+    double* k1 = work;
+    double* k2 = k1 + n;
+    double* k3 = k2 + n;
+    double* k4 = k3 + n;
+    double* tmp = k4 + n;
+    const double h = interval / static_cast<double>(steps);
+    for (std::size_t step = 0; step < steps; ++step) {
+        if (step % CANCEL_CHECK_STEPS == CANCEL_CHECK_STEPS - 1) throw_if_cancelled();
+        const double t = h * static_cast<double>(step);
+        ode.derivatives(y, t, k1);
+        if (method == Integrator::Euler) {
+            for (std::size_t i = 0; i < n; ++i) y[i] += h * k1[i];
+            continue;
+        }
+        for (std::size_t i = 0; i < n; ++i) tmp[i] = y[i] + 0.5 * h * k1[i];
+        ode.derivatives(tmp, t + 0.5 * h, k2);
+        for (std::size_t i = 0; i < n; ++i) tmp[i] = y[i] + 0.5 * h * k2[i];
+        ode.derivatives(tmp, t + 0.5 * h, k3);
+        for (std::size_t i = 0; i < n; ++i) tmp[i] = y[i] + h * k3[i];
+        ode.derivatives(tmp, t + h, k4);
+        for (std::size_t i = 0; i < n; ++i) {
+            y[i] += h / 6.0 * (k1[i] + 2.0 * k2[i] + 2.0 * k3[i] + k4[i]);
+        }
+    }
+}
+
+// Dormand-Prince 5(4): the fifth-order solution advances, the embedded
+// fourth-order one estimates the error. The last stage is the first
+// stage of the next step (first same as last).
+static void adaptive_steps(const OdeProcess& ode, double* y, double* work, std::size_t n, double interval,
+                           const IntegratorOptions& options) {
+    static const double C[7] = {0.0, 1.0 / 5, 3.0 / 10, 4.0 / 5, 8.0 / 9, 1.0, 1.0};
+    static const double A[7][6] = {
+        {},
+        {1.0 / 5},
+        {3.0 / 40, 9.0 / 40},
+        {44.0 / 45, -56.0 / 15, 32.0 / 9},
+        {19372.0 / 6561, -25360.0 / 2187, 64448.0 / 6561, -212.0 / 729},
+        {9017.0 / 3168, -355.0 / 33, 46732.0 / 5247, 49.0 / 176, -5103.0 / 18656},
+        {35.0 / 384, 0.0, 500.0 / 1113, 125.0 / 192, -2187.0 / 6784, 11.0 / 84},
+    };
+    // Fifth-order weights minus fourth-order weights.
+    static const double E[7] = {71.0 / 57600,  0.0,         -71.0 / 16695, 71.0 / 1920,
+                                -17253.0 / 339200, 22.0 / 525, -1.0 / 40};
+
+    double* k[7];
+    for (int j = 0; j < 7; ++j) k[j] = work + j * n;
+    double* tmp = work + 7 * n;
+
+    double t = 0.0;
+    double h = interval / static_cast<double>(options.substeps);
+    ode.derivatives(y, t, k[0]);
+    for (std::size_t step = 0; t < interval; ++step) {
+        if (step >= options.max_steps) {
+            throw std::runtime_error("integrator took more than " + std::to_string(options.max_steps) +
+                                     " steps; raise max_steps or the tolerances");
+        }
+        if (step % CANCEL_CHECK_STEPS == CANCEL_CHECK_STEPS - 1) throw_if_cancelled();
+        // The last step lands exactly on the end of the interval.
+        bool last = h >= interval - t;
+        if (last) {
+            h = interval - t;
+        } else if (h <= interval * 1e-14) {
+            throw std::runtime_error("integrator step size underflow");
+        }
+
+        for (int j = 1; j < 7; ++j) {
+            for (std::size_t i = 0; i < n; ++i) {
+                double sum = 0.0;
+                for (int m = 0; m < j; ++m) sum += A[j][m] * k[m][i];
+                tmp[i] = y[i] + h * sum;
+            }
+            ode.derivatives(tmp, t + C[j] * h, k[j]);
+        }
+        // tmp now holds the fifth-order solution (the last stage's input).
+        double norm = 0.0;
+        for (std::size_t i = 0; i < n; ++i) {
+            double err = 0.0;
+            for (int j = 0; j < 7; ++j) err += E[j] * k[j][i];
+            double scale = options.atol + options.rtol * std::max(std::fabs(y[i]), std::fabs(tmp[i]));
+            double e = h * err / scale;
+            norm += e * e;
+        }
+        norm = n > 0 ? std::sqrt(norm / static_cast<double>(n)) : 0.0;
+        if (!std::isfinite(norm)) {
+            h *= MIN_GROWTH;
+            continue;
+        }
+
+        double growth = norm > 0.0 ? SAFETY * std::pow(norm, -0.2) : MAX_GROWTH;
+        growth = std::min(MAX_GROWTH, std::max(MIN_GROWTH, growth));
+        if (norm <= 1.0) {
+            t = last ? interval : t + h;
+            std::copy(tmp, tmp + n, y);
+            std::swap(k[0], k[6]);
+        }
+        h *= growth;
+    }
+}
+
+// ---- OdeProcess ----
+
+const std::vector<std::size_t>& OdeProcess::output_sources() const {
+    std::call_once(matched_, [this] {
+        const StateLayout& outputs = output_layout();
+        std::vector<std::size_t> sources;
+        for (const std::string& name : outputs.names) {
+            int slot = input_layout().slot(name);
+            if (slot < 0) throw std::logic_error("output port '" + name + "' is not an ODE state port");
+            sources.push_back(static_cast<std::size_t>(slot));
+        }
+        output_sources_ = std::move(sources);
+    });
+    return output_sources_;
+}
+
+void OdeProcess::update_typed(const double* in, double* out, double interval) {
+    const std::vector<std::size_t>& sources = output_sources();
+    const std::size_t n = input_layout().size();
+    // Scratch is reused per thread so steady-state updates do not allocate.
+    thread_local std::vector<double> scratch;
+    if (scratch.size() < (WORK_SLOTS + 1) * n) scratch.resize((WORK_SLOTS + 1) * n);
+    double* y = scratch.data();
+    std::copy(in, in + n, y);
+    if (interval > 0.0) {
+        if (options_.method == Integrator::Adaptive) {
+            adaptive_steps(*this, y, y + n, n, interval, options_);
+        } else {
+            fixed_steps(*this, y, y + n, n, interval, options_.method, options_.substeps);
+        }
+    }
+    for (std::size_t o = 0; o < sources.size(); ++o) out[o] = y[sources[o]];
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+#include "typed_process.hpp"
+
+// ----------------------- Integrators -----------------------------
+// How an OdeProcess covers one update's interval:
+//
+//   euler, rk4   `substeps` equal steps of explicit Euler or classic
+//                fourth-order Runge-Kutta
+//   adaptive     Dormand-Prince 5(4) with error control: steps grow and
+//                shrink so that each one keeps the local error within
+//                atol + rtol * |y| for every slot
+//
+// Either way the client sends a single coarse interval and the server
+// takes as many internal steps as the method needs.
+
+enum class Integrator { Euler, Rk4, Adaptive };
+
+struct IntegratorOptions {
+    Integrator method = Integrator::Rk4;
+    std::size_t substeps = 1;       // euler, rk4: steps per update
+    double rtol = 1e-6;             // adaptive: relative tolerance
+    double atol = 1e-9;             // adaptive: absolute tolerance
+    std::size_t max_steps = 100000; // adaptive: accepted and rejected steps per update
+
+    // From the process config's optional "integrator" key, either a
+    // method name or {"method", "substeps", "rtol", "atol", "max_steps"}.
+    // Throws std::invalid_argument on an unknown method or a bad value.
+    static IntegratorOptions from_config(const json& cfg);
+};
+
+// ----------------------- ODE process -----------------------------
+// A TypedProcess defined by its time derivatives. The input slots are
+// the ODE's state y; derived classes implement
+//
+//   void derivatives(const double* y, double t, double* dydt) const;
+//
+// with t measured from the start of the update, and update_typed()
+// integrates y over the interval. Every output port must also be an
+// input port and reports that port's value at the end of the interval,
+// so outputs are usually declared with "_apply": "set".
+
+class OdeProcess : public TypedProcess {
+public:
+    explicit OdeProcess(IntegratorOptions options = {}) : options_(options) {}
+    OdeProcess(const OdeProcess& other) : TypedProcess(other), options_(other.options_) {}
+
+    virtual void derivatives(const double* y, double t, double* dydt) const = 0;
+
+    // Throws std::runtime_error if the adaptive method runs out of
+    // max_steps or its step size underflows, and std::logic_error if an
+    // output port is not an input port.
+    void update_typed(const double* in, double* out, double interval) override;
+
+    const IntegratorOptions& integrator() const { return options_; }
+
+private:
+    // Input slot of every output slot, matched by name once.
+    const std::vector<std::size_t>& output_sources() const;
+
+    IntegratorOptions options_;
+    mutable std::once_flag matched_;
+    mutable std::vector<std::size_t> output_sources_;
+};
@@ -0,0 +1,29 @@
+#include "param_blob.hpp"
+
+#include <climits>
+#include <cstdlib>
+#include <map>
+
+static std::mutex BLOBS_MU;
+static std::map<std::string, std::shared_ptr<const ParamBlob>> BLOBS;  // by real path
+
+std::shared_ptr<const ParamBlob> open_param_blob(const std::string& path) {
+    char resolved[PATH_MAX];
+    if (::realpath(path.c_str(), resolved) == nullptr) {
+        throw std::invalid_argument("parameter blob not found: " + path);
+    }
+    std::lock_guard<std::mutex> lock(BLOBS_MU);
+    std::shared_ptr<const ParamBlob>& blob = BLOBS[resolved];
+    if (!blob) blob = std::make_shared<const ParamBlob>(resolved);
+    return blob;
+}
+
+std::shared_ptr<const ParamBlob> config_blob(const json& cfg, const std::string& key) {
+    auto it = cfg.is_object() ? cfg.find(key) : cfg.end();
+    if (it == cfg.end()) return nullptr;
+    auto path = it->is_object() ? it->find("blob") : it->end();
+    if (path == it->end() || !path->is_string()) {
+        throw std::invalid_argument("'" + key + "' must be {\"blob\": \"<path>\"}");
+    }
+    return open_param_blob(path->get<std::string>());
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "mapped_file.hpp"
+#include "process.hpp"
+
+// ----------------------- Parameter blobs -------------------------
+// Large parameter tables do not belong in the JSON config: parsing them
+// makes every start slow, and every per-connection instance would hold
+// its own copy. Instead a config value of the form
+//
+//   "rates": {"blob": "/data/rates.f64"}
+//
+// names a binary file, and the builder takes a handle to it with
+// config_blob(cfg, "rates"). The file is mapped read-only the first time
+// its bytes are asked for, and every handle to the same file shares that
+// one mapping, so clones and per-connection rebuilds cost a shared_ptr
+// copy and the pages are loaded once, on demand, from the page cache.
+
+class ParamBlob {
+public:
+    explicit ParamBlob(std::string path) : path_(std::move(path)) {}
+
+    const std::string& path() const { return path_; }
+
+    // Maps the file on the first call. Throws std::runtime_error if that
+    // fails; a later call tries again.
+    std::string_view bytes() const {
+        std::call_once(mapped_, [this] { file_ = std::make_unique<MappedFile>(path_); });
+        return file_->bytes();
+    }
+    std::size_t size() const { return bytes().size(); }
+
+    // The blob as a packed array of T in host byte order, e.g.
+    // as<double>(). Throws std::runtime_error if the size is not a
+    // multiple of sizeof(T).
+    template <class T>
+    const T* as() const {
+        std::string_view b = bytes();
+        if (b.size() % sizeof(T) != 0) {
+            throw std::runtime_error("parameter blob " + path_ + " is not an array of " +
+                                     std::to_string(sizeof(T)) + "-byte values");
+        }
+        return reinterpret_cast<const T*>(b.data());
+    }
+    template <class T>
+    std::size_t count() const { return size() / sizeof(T); }
+
+private:
+    std::string path_;
+    mutable std::once_flag mapped_;
+    mutable std::unique_ptr<MappedFile> file_;
+};
+
+// The shared blob for the file at `path`; kept for the life of the
+// server once opened. Throws std::invalid_argument if there is no such
+// file. Nothing is mapped yet.
+std::shared_ptr<const ParamBlob> open_param_blob(const std::string& path);
+
+// The blob cfg[key] names, or nullptr if `cfg` has no `key`. Throws
+// std::invalid_argument if the value is not {"blob": "<path>"} or the
+// file does not exist, so a builder rejects the config at startup.
+std::shared_ptr<const ParamBlob> config_blob(const json& cfg, const std::string& key);
@@ -0,0 +1,178 @@
+#include "pool_allocator.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+static const std::size_t MIN_CLASS_SHIFT = 4;   // 16-byte blocks
+static const std::size_t MAX_CLASS_SHIFT = 16;  // 64 KiB blocks
+static const std::size_t CLASSES = MAX_CLASS_SHIFT - MIN_CLASS_SHIFT + 1;
+
+// A thread keeps up to this many bytes per class; past that, half of the
+// list moves to the shared depot so threads that mostly allocate (say,
+// the ones parsing requests) can pick up what others mostly free.
+static const std::size_t LOCAL_CLASS_BYTES = 256 * 1024;
+static const std::size_t MIN_LOCAL_BLOCKS = 8;
+static const std::size_t DEPOT_BYTES = 64 * 1024 * 1024;  // beyond this, blocks go back to the heap
+
+static std::atomic<std::uint64_t> HEAP_ALLOCATIONS{0};
+
+struct FreeBlock {
+    FreeBlock* next;
+};
+
+static std::size_t class_bytes(std::size_t cls) {
+    return std::size_t(1) << (cls + MIN_CLASS_SHIFT);
+}
+
+static std::size_t size_class(std::size_t bytes) {
+    if (bytes <= class_bytes(0)) return 0;
+    std::size_t shift = 64 - static_cast<std::size_t>(__builtin_clzll(bytes - 1));
+    return shift - MIN_CLASS_SHIFT;
+}
+
+static std::size_t local_limit(std::size_t cls) {
+    std::size_t blocks = LOCAL_CLASS_BYTES / class_bytes(cls);
+    return blocks < MIN_LOCAL_BLOCKS ? MIN_LOCAL_BLOCKS : blocks;
+}
+
+// ---- Shared depot ----
+// Whole batches move in and out under one lock per class, so the lock
+// is taken once per batch rather than once per block.
+
+struct DepotClass {
+    struct Batch {
+        FreeBlock* head;
+        std::size_t count;
+    };
+
+    std::mutex mu;
+    std::vector<Batch> batches;
+    std::size_t bytes = 0;
+};
+
+static DepotClass* depot() {
+    // Never destroyed: threads may still return blocks during exit.
+    static DepotClass* classes = new DepotClass[CLASSES];
+    return classes;
+}
+
+static void free_list(FreeBlock* head) {
+    while (head) {
+        FreeBlock* next = head->next;
+        ::operator delete(head);
+        head = next;
+    }
+}
+
+static void depot_put(std::size_t cls, FreeBlock* head, std::size_t count) {
+    if (!head) return;
+    DepotClass& d = depot()[cls];
+    std::size_t bytes = count * class_bytes(cls);
+    {
+        std::lock_guard<std::mutex> lock(d.mu);
+        if (d.bytes + bytes <= DEPOT_BYTES) {
+            d.batches.push_back(DepotClass::Batch{head, count});
+            d.bytes += bytes;
+            return;
+        }
+    }
+    free_list(head);
+}
+
+static FreeBlock* depot_take(std::size_t cls, std::size_t& count) {
+    DepotClass& d = depot()[cls];
+    std::lock_guard<std::mutex> lock(d.mu);
+    if (d.batches.empty()) return nullptr;
+    DepotClass::Batch batch = d.batches.back();
+    d.batches.pop_back();
+    count = batch.count;
+    d.bytes -= count * class_bytes(cls);
+    return batch.head;
+}
+
+// ---- Thread caches ----
+
+// Trivially destructible, so it stays usable while other thread_local
+// objects holding json values are destroyed at thread exit; `closed`
+// then routes everything to the heap.
+struct ThreadCache {
+    FreeBlock* heads[CLASSES];
+    std::size_t counts[CLASSES];
+    bool registered;
+    bool closed;
+};
+
+static thread_local ThreadCache CACHE;
+
+// Hands the thread's blocks to the depot when it exits.
+struct CacheReleaser {
+    ~CacheReleaser() {
+        CACHE.closed = true;
+        for (std::size_t cls = 0; cls < CLASSES; ++cls) {
+            depot_put(cls, CACHE.heads[cls], CACHE.counts[cls]);
+            CACHE.heads[cls] = nullptr;
+            CACHE.counts[cls] = 0;
+        }
+    }
+};
+
+static void register_cache() {
+    thread_local CacheReleaser releaser;
+    (void)releaser;
+    CACHE.registered = true;
+}
+
+void* pool_allocate(std::size_t bytes) {
+    if (bytes > class_bytes(CLASSES - 1)) {
+        HEAP_ALLOCATIONS.fetch_add(1, std::memory_order_relaxed);
+        return ::operator new(bytes);
+    }
+    std::size_t cls = size_class(bytes);
+    if (CACHE.closed) {
+        // Still a full class block: a live thread may free it onto a list.
+        HEAP_ALLOCATIONS.fetch_add(1, std::memory_order_relaxed);
+        return ::operator new(class_bytes(cls));
+    }
+    if (!CACHE.registered) register_cache();
+
+    FreeBlock* block = CACHE.heads[cls];
+    if (!block) {
+        block = depot_take(cls, CACHE.counts[cls]);
+        if (!block) {
+            HEAP_ALLOCATIONS.fetch_add(1, std::memory_order_relaxed);
+            return ::operator new(class_bytes(cls));
+        }
+    }
+    CACHE.heads[cls] = block->next;
+    --CACHE.counts[cls];
+    return block;
+}
+
+void pool_deallocate(void* p, std::size_t bytes) {
+    if (!p) return;
+    if (bytes > class_bytes(CLASSES - 1) || CACHE.closed) {
+        ::operator delete(p);
+        return;
+    }
+    if (!CACHE.registered) register_cache();
+
+    std::size_t cls = size_class(bytes);
+    auto* block = static_cast<FreeBlock*>(p);
+    block->next = CACHE.heads[cls];
+    CACHE.heads[cls] = block;
+    if (++CACHE.counts[cls] <= local_limit(cls)) return;
+
+    // Keep the newest half, which is the most likely to still be in cache.
+    std::size_t keep = local_limit(cls) / 2;
+    FreeBlock* last = CACHE.heads[cls];
+    for (std::size_t i = 1; i < keep; ++i) last = last->next;
+    FreeBlock* spill = last->next;
+    last->next = nullptr;
+    depot_put(cls, spill, CACHE.counts[cls] - keep);
+    CACHE.counts[cls] = keep;
+}
+
+std::uint64_t pool_heap_allocations() {
+    return HEAP_ALLOCATIONS.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+// ----------------------- Pool allocator --------------------------
+// Backs the containers inside `json` values (object maps, arrays and
+// their nodes). Freed blocks are kept on per-thread free lists, one per
+// power-of-two size class, and handed out again by the next allocation
+// of that class on the same thread, so a steady stream of similar
+// requests stops reaching the global allocator after warm-up. A block
+// may be freed on a different thread than it was allocated on; it then
+// joins that thread's lists.
+//
+// Each thread caches a bounded number of bytes; beyond that, and for
+// blocks larger than the biggest class, the global heap is used
+// directly. Strings keep std::allocator: the short ones used for keys
+// fit in the small-string buffer anyway.
+
+void* pool_allocate(std::size_t bytes);
+void pool_deallocate(void* p, std::size_t bytes);
+
+// Allocations that missed the free lists and went to the heap, summed
+// over all threads.
+std::uint64_t pool_heap_allocations();
+
+template <class T>
+struct PoolAllocator {
+    using value_type = T;
+
+    PoolAllocator() noexcept = default;
+    template <class U>
+    PoolAllocator(const PoolAllocator<U>&) noexcept {}
+
+    T* allocate(std::size_t n) {
+        if (alignof(T) > alignof(std::max_align_t)) {
+            return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(alignof(T))));
+        }
+        return static_cast<T*>(pool_allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept {
+        if (alignof(T) > alignof(std::max_align_t)) {
+            ::operator delete(p, std::align_val_t(alignof(T)));
+            return;
+        }
+        pool_deallocate(p, n * sizeof(T));
+    }
+};
+
+template <class T, class U>
+bool operator==(const PoolAllocator<T>&, const PoolAllocator<U>&) noexcept { return true; }
+template <class T, class U>
+bool operator!=(const PoolAllocator<T>&, const PoolAllocator<U>&) noexcept { return false; }
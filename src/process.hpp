@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "pool_allocator.hpp"
+
+// nlohmann::json with its objects and arrays on the pool allocator.
+using json = nlohmann::basic_json<std::map, std::vector, std::string, bool, std::int64_t,
+                                  std::uint64_t, double, PoolAllocator>;
+
+// ----------------------- Process interface -----------------------
+
+// How a Process tolerates concurrent calls. This is its contract with
+// the server: it decides whether update_batch may fan out, and how a
+// single instance is guarded when shared between connections.
+enum class Concurrency {
+    Serialized,   // one call at a time, from any thread (the default)
+    Reentrant,    // calls may run concurrently on one instance
+    Stateless,    // update() depends only on its arguments
+    ThreadAffine, // one call at a time, always from the same thread; needs server.share_process
+};
+
+struct Process {
+    virtual ~Process() = default;
+    virtual json inputs() const = 0;
+    virtual json outputs() const = 0;
+    virtual json update(const json& state, double interval) = 0;
+
+    virtual Concurrency concurrency() const { return Concurrency::Serialized; }
+
+    // Identifies the current inputs()/outputs() schemas among instances
+    // of the same type. The server caches serialized schemas per type and
+    // version, so a process whose schemas change over time or depend on
+    // its configuration must return a different value for each variant.
+    virtual uint64_t schema_version() const { return 0; }
+
+    // True if update() returns the same reply for the same declared input
+    // ports and interval, on any instance built from the same config.
+    // That makes plain updates eligible for the server's result cache
+    // (result_cache.hpp), which pays off when update() is expensive and
+    // clients repeat themselves.
+    virtual bool deterministic() const { return false; }
+
+    // A new instance in the same configured state, used to give every
+    // connection its own copy of the startup prototype. Returning
+    // nullptr (the default) makes the server rebuild from the config
+    // instead.
+    virtual std::unique_ptr<Process> clone() const { return nullptr; }
+
+    // Internal state for checkpoint/restore (snapshot.hpp): whatever the
+    // process keeps between calls that a fresh build from the config
+    // would not have, such as warmed caches or fitted parameters.
+    // save_state() appends an opaque binary image of it to `out`;
+    // load_state() rebuilds the state from such an image, which may live
+    // in a read-only mapping that goes away once it returns. It should
+    // throw std::runtime_error if the image is not one of its own. Both
+    // are called like update(), under the same concurrency() contract.
+    // The default has nothing to save.
+    virtual void save_state(std::string& out) const { (void)out; }
+    virtual void load_state(std::string_view image) { (void)image; }
+};
@@ -0,0 +1,399 @@
+#include "protocol.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include "batch_process.hpp"
+#include "cancel.hpp"
+#include "metrics.hpp"
+#include "snapshot.hpp"
+
+// Batches smaller than this run on the calling worker alone.
+static const size_t BATCH_GRAIN = 64;
+static const size_t COLUMN_GRAIN = 4096;  // rows, for update_columns
+
+// The command's arguments, by reference: states can be large.
+static const json& command_arguments(const json& cmd) {
+    static const json EMPTY = json::object();
+    auto it = cmd.find("arguments");
+    return it != cmd.end() ? *it : EMPTY;
+}
+
+// An update's interval: 0 when missing, an error when not a number.
+// The fast parser (fast_update.hpp) leaves such updates to this path.
+static bool update_interval(const json& args, double& interval) {
+    interval = 0.0;
+    auto it = args.is_object() ? args.find("interval") : args.end();
+    if (it == args.end()) return true;
+    if (!it->is_number()) return false;
+    interval = it->get<double>();
+    return true;
+}
+
+static json bad_interval_reply() {
+    return json{{"error", "update expects 'interval' to be a number"}};
+}
+
+static json run_update(const json& args, Process& process) {
+    static const json EMPTY = json::object();
+    if (!args.is_object()) {
+        return json{{"error", "update expects an arguments object"}};
+    }
+    double interval = 0.0;
+    if (!update_interval(args, interval)) return bad_interval_reply();
+    auto it = args.find("state");
+    return process.update(it != args.end() ? *it : EMPTY, interval);
+}
+
+// update with a session: "delta" is an RFC 7386 merge patch (null
+// removes a key) against the cached state; a full "state" replaces the
+// cache once delta mode is on.
+static json run_session_update(const json& args, Process& process, Session& session) {
+    double interval = 0.0;
+    if (!update_interval(args, interval)) return bad_interval_reply();
+    if (args.is_object() && args.contains("delta")) {
+        const json& delta = args.at("delta");
+        if (!delta.is_object()) {
+            return json{{"error", "update expects 'delta' to be an object"}};
+        }
+        session.state.merge_patch(delta);
+        session.has_state = true;
+    } else if (session.has_state && args.is_object() && args.contains("state")) {
+        session.state = args.at("state");
+    } else {
+        return run_update(args, process);
+    }
+    return process.update(session.state, interval);
+}
+
+// Whether a batch may fan out over the pool: the process must allow
+// concurrent calls, and the request may opt out with "parallel": false.
+static bool batch_parallel(const json& args, const Process& process, WorkerPool* pool) {
+    Concurrency c = process.concurrency();
+    bool parallel = pool != nullptr && (c == Concurrency::Reentrant || c == Concurrency::Stateless);
+    if (args.contains("parallel")) {
+        try { parallel = parallel && args.at("parallel").get<bool>(); } catch (...) {}
+    }
+    return parallel;
+}
+
+// Runs body over [0, n), checking for cancellation before each chunk.
+static void run_chunks(size_t n, size_t grain, bool parallel, WorkerPool* pool,
+                       const std::function<void(size_t, size_t)>& body) {
+    if (parallel) {
+        pool->parallel_for(n, grain, [&](size_t begin, size_t end) {
+            throw_if_cancelled();
+            body(begin, end);
+        });
+        return;
+    }
+    for (size_t begin = 0; begin < n; begin += grain) {
+        throw_if_cancelled();
+        body(begin, std::min(n, begin + grain));
+    }
+}
+
+// update_batch on a BatchProcess: each chunk of entries is unpacked into
+// columns, updated with one update_columns() call and packed back.
+static void update_entries_columnar(const json& entries, BatchProcess& process, json::array_t& results,
+                                    bool parallel, WorkerPool* pool) {
+    static const json EMPTY = json::object();
+    const size_t n = entries.size();
+    const size_t inputs = process.input_layout().size();
+    const size_t outputs = process.output_layout().size();
+    ColumnBuffer columns(process, n);
+    std::vector<char> bad_interval(n, 0);
+
+    run_chunks(n, BATCH_GRAIN, parallel, pool, [&](size_t begin, size_t end) {
+        std::vector<double> row(std::max(inputs, outputs));
+        for (size_t i = begin; i < end; ++i) {
+            const json& entry = entries[i];
+            if (!entry.is_object()) continue;
+            auto it = entry.find("state");
+            process.read_inputs(it != entry.end() ? *it : EMPTY, row.data());
+            for (size_t s = 0; s < inputs; ++s) columns.in(s)[i] = row[s];
+            bad_interval[i] = !update_interval(entry, columns.intervals()[i]);
+        }
+        columns.update(process, begin, end);
+        for (size_t i = begin; i < end; ++i) {
+            if (!entries[i].is_object()) {
+                results[i] = json{{"error", "invalid batch entry"}};
+                continue;
+            }
+            if (bad_interval[i]) {
+                results[i] = bad_interval_reply();
+                continue;
+            }
+            for (size_t s = 0; s < outputs; ++s) row[s] = columns.out(s)[i];
+            results[i] = process.write_outputs(row.data());
+        }
+    });
+}
+
+// update_batch: {"entries": [{"state": {...}, "interval": dt}, ...]}
+// replies with the list of update results in entry order.
+static json run_update_batch(const json& args, Process& process, WorkerPool* pool) {
+    if (!args.is_object() || !args.contains("entries") || !args.at("entries").is_array()) {
+        return json{{"error", "update_batch expects an 'entries' array"}};
+    }
+    const json& entries = args.at("entries");
+    const size_t n = entries.size();
+    bool parallel = batch_parallel(args, process, pool);
+
+    json::array_t results(n);
+    if (auto* batch_process = dynamic_cast<BatchProcess*>(&process)) {
+        update_entries_columnar(entries, *batch_process, results, parallel, pool);
+    } else {
+        run_chunks(n, BATCH_GRAIN, parallel, pool, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                const json& entry = entries[i];
+                results[i] = entry.is_object() ? run_update(entry, process)
+                                               : json{{"error", "invalid batch entry"}};
+            }
+        });
+    }
+
+    json out = json::array();
+    out.get_ref<json::array_t&>() = std::move(results);
+    return out;
+}
+
+// update_columns: {"columns": {port: [v0, v1, ...], ...}, "interval": dt}
+// (or "intervals": [dt0, dt1, ...]) updates one state per row and
+// replies {"columns": {port: [...]}} with a column per output port. A
+// missing input column, or a non-number in one, reads as the default.
+static json run_update_columns(const json& args, Process& process, WorkerPool* pool) {
+    auto* typed = dynamic_cast<TypedProcess*>(&process);
+    if (!typed) {
+        return json{{"error", "update_columns needs a process with numeric ports"}};
+    }
+    if (!args.is_object() || !args.contains("columns") || !args.at("columns").is_object()) {
+        return json{{"error", "update_columns expects a 'columns' object"}};
+    }
+    const json& given = args.at("columns");
+    const StateLayout& in_layout = typed->input_layout();
+    const StateLayout& out_layout = typed->output_layout();
+
+    // Every column and the intervals, if given per row, set the row count.
+    std::vector<const json*> sources(in_layout.size(), nullptr);
+    size_t rows = 0;
+    bool sized = false;
+    auto take = [&](const json& column) {
+        if (!column.is_array()) return false;
+        if (sized && column.size() != rows) return false;
+        rows = column.size();
+        sized = true;
+        return true;
+    };
+    for (size_t s = 0; s < in_layout.size(); ++s) {
+        auto it = given.find(in_layout.names[s]);
+        if (it == given.end()) continue;
+        if (!take(*it)) return json{{"error", "update_columns expects arrays of equal length"}};
+        sources[s] = &*it;
+    }
+    const json* intervals = nullptr;
+    auto it = args.find("intervals");
+    if (it != args.end()) {
+        if (!take(*it)) return json{{"error", "update_columns expects arrays of equal length"}};
+        intervals = &*it;
+        for (const json& v : *intervals) {
+            if (!v.is_number()) return bad_interval_reply();
+        }
+    }
+    double interval = 0.0;
+    if (!update_interval(args, interval)) return bad_interval_reply();
+
+    ColumnBuffer columns(*typed, rows);
+    std::vector<json::array_t> results(out_layout.size(), json::array_t(rows));
+    run_chunks(rows, COLUMN_GRAIN, batch_parallel(args, process, pool), pool, [&](size_t begin, size_t end) {
+        for (size_t s = 0; s < sources.size(); ++s) {
+            if (!sources[s]) continue;
+            const json& source = *sources[s];
+            double* column = columns.in(s);
+            for (size_t i = begin; i < end; ++i) {
+                if (source[i].is_number()) column[i] = source[i].get<double>();
+            }
+        }
+        double* dt = columns.intervals();
+        for (size_t i = begin; i < end; ++i) {
+            dt[i] = intervals ? (*intervals)[i].get<double>() : interval;
+        }
+        columns.update(*typed, begin, end);
+        for (size_t s = 0; s < results.size(); ++s) {
+            const double* column = columns.out(s);
+            for (size_t i = begin; i < end; ++i) results[s][i] = column[i];
+        }
+    });
+
+    json out_columns = json::object();
+    for (size_t s = 0; s < results.size(); ++s) {
+        json& column = out_columns[out_layout.names[s]];
+        column = json::array();
+        column.get_ref<json::array_t&>() = std::move(results[s]);
+    }
+    return json{{"columns", std::move(out_columns)}};
+}
+
+// checkpoint / restore: {"name": ...} under the session's checkpoint_dir.
+// A restore replaces the process's state and the session's delta state.
+static json run_checkpoint(const std::string& cname, const json& args, Process& process,
+                           Session* session) {
+    if (session == nullptr || session->checkpoint_dir == nullptr) {
+        return json{{"error", "checkpoints are disabled (set server.checkpoint_dir)"}};
+    }
+    auto name = args.is_object() ? args.find("name") : args.end();
+    if (name == args.end() || !name->is_string()) {
+        return json{{"error", cname + " expects a 'name'"}};
+    }
+    const std::string& checkpoint = name->get_ref<const std::string&>();
+    std::string path = checkpoint_path(*session->checkpoint_dir, checkpoint);
+    if (cname == "checkpoint") {
+        std::size_t bytes = save_checkpoint(path, process, session);
+        return json{{"checkpoint", checkpoint}, {"bytes", bytes}};
+    }
+    std::size_t bytes = load_checkpoint(path, process, session);
+    ResultCache::instance().clear();  // cached results may predate the restored state
+    return json{{"restored", checkpoint}, {"bytes", bytes}};
+}
+
+static json dispatch_command(const std::string& cname, const json& cmd, Process& process,
+                             Session* session) {
+    if (cname == "inputs") {
+        return process.inputs();
+    } else if (cname == "outputs") {
+        return process.outputs();
+    } else if (cname == "update") {
+        if (session) return run_session_update(command_arguments(cmd), process, *session);
+        return run_update(command_arguments(cmd), process);
+    } else if (cname == "update_batch") {
+        return run_update_batch(command_arguments(cmd), process, session ? session->pool : nullptr);
+    } else if (cname == "update_columns") {
+        return run_update_columns(command_arguments(cmd), process, session ? session->pool : nullptr);
+    } else if (cname == "run") {
+        return run_simulation(command_arguments(cmd), process, session ? &session->stream : nullptr);
+    } else if (cname == "reset_state") {
+        if (session) {
+            session->state = json::object();
+            session->has_state = false;
+        }
+        return json{{"reset", true}};
+    } else if (cname == "checkpoint" || cname == "restore") {
+        return run_checkpoint(cname, command_arguments(cmd), process, session);
+    } else if (cname == "metrics") {
+        return Metrics::instance().snapshot();
+    } else {
+        return json{{"error", std::string("unknown command: ") + cname}};
+    }
+}
+
+json run_command(const json& cmd, Process& process, Session* session) {
+    if (!cmd.contains("command")) {
+        return json{{"error", "missing 'command' field"}};
+    }
+    std::string cname;
+    try {
+        cname = cmd.at("command").get<std::string>();
+    } catch (...) {
+        return json{{"error", "invalid 'command' field"}};
+    }
+
+    Metrics& metrics = Metrics::instance();
+    if (!metrics.enabled()) return dispatch_command(cname, cmd, process, session);
+
+    // A streaming run is timed until it is set up, not until its last frame.
+    uint64_t start = metrics_now_ns();
+    json reply;
+    try {
+        reply = dispatch_command(cname, cmd, process, session);
+    } catch (...) {
+        metrics.record_command(command_kind(cname), metrics_now_ns() - start, true);
+        throw;
+    }
+    bool error = reply.is_object() && reply.contains("error");
+    metrics.record_command(command_kind(cname), metrics_now_ns() - start, error);
+    return reply;
+}
+
+// Commands that read or change the connection's session, which only
+// the queue may touch.
+static bool uses_session(const json& cmd, const Session& session) {
+    auto name = cmd.find("command");
+    if (name == cmd.end() || !name->is_string()) return false;
+    const std::string& cname = name->get_ref<const std::string&>();
+    const json& args = command_arguments(cmd);
+    if (cname == "update") {
+        return session.has_state || (args.is_object() && args.contains("delta"));
+    }
+    if (cname == "run") {
+        auto stream = args.is_object() ? args.find("stream") : args.end();
+        return stream != args.end() && stream->is_boolean() && stream->get<bool>();
+    }
+    return cname == "reset_state" || cname == "checkpoint" || cname == "restore";
+}
+
+bool allows_concurrent_calls(const Process& process) {
+    Concurrency c = process.concurrency();
+    return c == Concurrency::Reentrant || c == Concurrency::Stateless;
+}
+
+bool is_async_request(const json& cmd, const Process& process, const Session& session) {
+    auto it = cmd.find("async");
+    if (it != cmd.end() && it->is_boolean()) return it->get<bool>();
+    return cmd.contains("id") && allows_concurrent_calls(process) && !uses_session(cmd, session);
+}
+
+json async_request_error(const json& cmd, const Session& session) {
+    if (!cmd.contains("id")) return json{{"error", "async requests need an 'id'"}};
+    const json& args = command_arguments(cmd);
+    if (args.is_object()) {
+        auto stream = args.find("stream");
+        if (stream != args.end() && stream->is_boolean() && stream->get<bool>()) {
+            return json{{"error", "async runs cannot stream"}};
+        }
+        // The cached delta state belongs to the connection's queue.
+        if (args.contains("delta")) return json{{"error", "async updates need a full 'state'"}};
+    }
+    auto name = cmd.find("command");
+    if (name != cmd.end() && (*name == "checkpoint" || *name == "restore")) {
+        return json{{"error", "checkpoint and restore cannot run async"}};
+    }
+    if (name != cmd.end() && *name == "reset_state") {
+        return json{{"error", "reset_state cannot run async"}};
+    }
+    // Anything else the queue must run, such as an update in delta mode.
+    if (uses_session(cmd, session)) {
+        return json{{"error", "this request depends on the connection's session and cannot run async"}};
+    }
+    return json(json::value_t::discarded);
+}
+
+void tag_reply(json& reply, const json& id) {
+    if (reply.is_object()) {
+        reply["id"] = id;
+    } else {
+        reply = json{{"id", id}, {"result", std::move(reply)}};
+    }
+}
+
+bool update_result_key(const json& cmd, const Process& process, const Session* session, ResultKey& key) {
+    if (!ResultCache::instance().enabled() || !cmd.is_object()) return false;
+    auto name = cmd.find("command");
+    if (name == cmd.end() || *name != "update") return false;
+    const json& args = command_arguments(cmd);
+    if (!args.is_object() || args.contains("delta") || (session != nullptr && session->has_state)) {
+        return false;
+    }
+    auto state = args.find("state");
+    double interval = 0.0;
+    if (state == args.end() || !update_interval(args, interval)) return false;
+    return result_key(process, *state, interval, key);
+}
+
+bool is_blank_line(const std::string& line) {
+    return line.find_first_not_of(" \t\r") == std::string::npos;
+}
+
+json invalid_json_reply() {
+    return json{{"error", "invalid json"}};
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <string>
+
+#include "process.hpp"
+#include "result_cache.hpp"
+#include "run.hpp"
+#include "worker_pool.hpp"
+
+// ----------------------- Command router --------------------------
+
+// Per-connection state that outlives a single command. A command run
+// without a Session behaves as if every connection were brand new.
+struct Session {
+    // Lets update_batch spread its entries over the worker pool for
+    // processes that allow concurrent updates.
+    WorkerPool* pool = nullptr;
+
+    // Where checkpoint and restore keep their files; nullptr disables
+    // both commands.
+    const std::string* checkpoint_dir = nullptr;
+
+    // Delta mode: the last state the client sent, with every later
+    // "delta" merge-patched into it.
+    json state = json::object();
+    bool has_state = false;
+
+    // A streaming run started by the last command. While it is set the
+    // command's reply is the stream's frames, pulled by the server.
+    std::unique_ptr<RunStream> stream;
+};
+
+// Returns a discarded value when the reply is left in session->stream.
+json run_command(const json& cmd, Process& process, Session* session = nullptr);
+
+// ---- Request ids and async requests ----
+// Every reply to a request with an "id" carries the same id. If the
+// process allows concurrent calls, such a request also runs off the
+// connection's queue unless it depends on the session (a delta update,
+// any update once delta mode is on, a streaming run, reset_state,
+// checkpoint, restore) or says "async": false: later requests are
+// answered while it computes, and its reply may overtake theirs.
+// "async": true asks for that explicitly, for any process, and is an
+// error where it cannot be done. A process that does not allow
+// concurrent calls then runs it on a separate instance.
+// {"command": "cancel", "arguments": {"id": ...}} cancels an async
+// request that has not finished.
+
+// Concurrency::Stateless or Reentrant.
+bool allows_concurrent_calls(const Process& process);
+bool is_async_request(const json& cmd, const Process& process, const Session& session);
+// Why `cmd` cannot run asynchronously, or a discarded value if it can:
+// it is an error for anything is_async_request() would keep in line
+// for the session's sake.
+json async_request_error(const json& cmd, const Session& session);
+// Adds "id" to an object reply; any other reply becomes
+// {"id": ..., "result": reply}.
+void tag_reply(json& reply, const json& id);
+
+// The result cache key of `cmd` if it is an update the cache may answer:
+// a plain update of a deterministic process, outside delta mode.
+bool update_result_key(const json& cmd, const Process& process, const Session* session, ResultKey& key);
+
+// Blank lines (only spaces, tabs or '\r') carry no request.
+bool is_blank_line(const std::string& line);
+
+// Reply to an NDJSON message that does not decode as JSON.
+json invalid_json_reply();
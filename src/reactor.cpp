@@ -0,0 +1,935 @@
+#include "reactor.hpp"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+#include "metrics.hpp"
+#include "net.hpp"
+#include "protocol.hpp"
+#include "result_cache.hpp"
+#include "schema_cache.hpp"
+
+static const int MAX_EVENTS = 256;
+static const int TICK_MS = 200;  // how often the loop re-checks `running`
+static const size_t STREAM_HIGH_WATER = 1024 * 1024;  // unsent bytes that park a stream
+static const size_t RETAIN_BUFFER_BYTES = 4 * 1024 * 1024;  // larger buffers are freed once empty
+static const long OVERLOAD_RETRY_MS = 100;  // retry_after_ms of a request shed under overload
+
+static bool is_command(const json& cmd, const char* name) {
+    auto it = cmd.find("command");
+    return it != cmd.end() && it->is_string() && it->get_ref<const json::string_t&>() == name;
+}
+
+// The id to echo in the reply, from the DOM or the fast parser.
+static const json* request_id(const Request& req) {
+    if (req.fast) return req.fast_update.has_id ? &req.fast_update.id : nullptr;
+    if (!req.cmd.is_object()) return nullptr;
+    auto it = req.cmd.find("id");
+    return it != req.cmd.end() ? &*it : nullptr;
+}
+
+// The request's result cache key, if the cache may answer it. A fast
+// update always targets a typed process.
+static bool request_result_key(const Request& req, const Process& process, const Session* session,
+                               ResultKey& key) {
+    if (req.fast) {
+        return result_key(dynamic_cast<const TypedProcess&>(process), req.fast_update.inputs.data(),
+                          req.fast_update.interval, key);
+    }
+    return !req.cmd.is_discarded() && update_result_key(req.cmd, process, session, key);
+}
+
+Reactor::Reactor(std::vector<int> listen_fds, const ServerOptions& opts, WorkerPool& pool,
+                 ProcessFactory factory)
+    : opts_(opts), pool_(pool), factory_(std::move(factory)) {
+    epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0) {
+        perror("epoll_create1");
+        return;
+    }
+    wake_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd_ < 0) {
+        perror("eventfd");
+        return;
+    }
+
+    epoll_event ev{};
+    for (int fd : listen_fds) {
+        listeners_.push_back(Listener{fd, is_tcp_socket(fd)});
+        set_nonblocking(fd);
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.fd = fd;
+        if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl listen");
+        }
+    }
+    ev.events = EPOLLIN;
+    ev.data.fd = wake_fd_;
+    if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev) < 0) {
+        perror("epoll_ctl eventfd");
+    }
+}
+
+Reactor::~Reactor() {
+    for (auto& entry : conns_) {
+        ::close(entry.first);
+    }
+    if (wake_fd_ >= 0) ::close(wake_fd_);
+    if (epoll_fd_ >= 0) ::close(epoll_fd_);
+}
+
+void Reactor::run(const std::atomic<bool>& running) {
+    while (running.load()) {
+        if (!poll(TICK_MS)) return;
+    }
+    drain_connections();
+}
+
+// Waits up to `timeout_ms` for events and handles them. Returns false if
+// epoll itself failed.
+bool Reactor::poll(int timeout_ms) {
+    epoll_event events[MAX_EVENTS];
+    int n = ::epoll_wait(epoll_fd_, events, MAX_EVENTS, timeout_ms);
+    if (n < 0) {
+        if (errno == EINTR) return true;
+        perror("epoll_wait");
+        return false;
+    }
+    for (int i = 0; i < n; ++i) {
+        int fd = events[i].data.fd;
+        if (const Listener* listener = find_listener(fd)) {
+            accept_all(*listener);
+        } else if (fd == wake_fd_) {
+            handle_posted();
+        } else {
+            auto it = conns_.find(fd);
+            if (it == conns_.end()) continue;
+            std::shared_ptr<Connection> conn = it->second;
+            if (events[i].events & EPOLLOUT) {
+                on_writable(conn);
+            }
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                on_readable(conn);
+            }
+        }
+    }
+    return true;
+}
+
+// Each connection is treated as if its peer had stopped sending: queued
+// requests still run and are answered, then the usual end-of-input path
+// flushes and closes it. The event loop keeps running for that until no
+// connection is left or the deadline passes.
+void Reactor::drain_connections() {
+    for (const Listener& listener : listeners_) {
+        // Connections still in the backlog are reset when main closes the
+        // listener; the kernel already sends new ones to other listeners.
+        ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, listener.fd, nullptr);
+    }
+
+    drain_report_ = DrainReport{};
+    drain_report_.connections = conns_.size();
+    std::vector<std::shared_ptr<Connection>> open;
+    for (auto& entry : conns_) open.push_back(entry.second);
+    for (auto& conn : open) {
+        drain_report_.requests += conn->inflight.load();
+        stop_reading(conn);
+    }
+
+    using clock = std::chrono::steady_clock;
+    auto deadline = clock::now() + std::chrono::milliseconds(opts_.drain_timeout_ms);
+    while (!conns_.empty()) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - clock::now()).count();
+        if (left <= 0) break;
+        if (!poll(static_cast<int>(std::min<long long>(left, TICK_MS)))) break;
+    }
+
+    size_t unanswered = 0;
+    open.clear();
+    for (auto& entry : conns_) open.push_back(entry.second);
+    for (auto& conn : open) {
+        unanswered += conn->inflight.load();
+        abandon(conn);
+    }
+    drain_report_.abandoned = open.size();
+    drain_report_.completed = drain_report_.requests - std::min(unanswered, drain_report_.requests);
+}
+
+void Reactor::stop_reading(const std::shared_ptr<Connection>& conn) {
+    conn->eof = true;
+    bool schedule = false;
+    {
+        std::lock_guard<std::mutex> lock(conn->mu);
+        if (conn->closing) return;
+        conn->peer_closed = true;
+        if (!conn->draining) {
+            conn->draining = true;
+            schedule = true;
+        }
+    }
+    if (schedule) {
+        pool_.submit([this, conn] { drain(conn); });
+    }
+}
+
+// Past the deadline: drop what is queued, stop any stream, cancel async
+// requests and close. A command already running finishes on its worker
+// unless it polls for cancellation, but its reply is discarded.
+void Reactor::abandon(const std::shared_ptr<Connection>& conn) {
+    conn->broken.store(true);
+    {
+        std::lock_guard<std::mutex> lock(conn->mu);
+        conn->pending.clear();
+        conn->peer_closed = true;
+        conn->closing = true;
+        cancel_all_async(*conn);
+    }
+    close_connection(conn);
+}
+
+const Reactor::Listener* Reactor::find_listener(int fd) const {
+    for (const Listener& listener : listeners_) {
+        if (listener.fd == fd) return &listener;
+    }
+    return nullptr;
+}
+
+void Reactor::accept_all(const Listener& listener) {
+    while (true) {
+        int client_fd = ::accept4(listener.fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("accept");
+            return;
+        }
+        if (!ConnectionSlots::instance().acquire(opts_.max_connections)) {
+            refuse_connection(client_fd);
+            continue;
+        }
+        tune_client_socket(client_fd, opts_.socket, listener.tcp);
+
+        // Each connection gets its own Process instance from the factory
+        // when it is accepted.
+        auto conn = std::make_shared<Connection>(client_fd, factory_(), opts_.max_line_bytes,
+                                                 opts_.protocol);
+        conn->limiter = RateLimiter(opts_.max_request_rate, opts_.request_burst);
+        conn->session.pool = &pool_;
+        if (!opts_.checkpoint_dir.empty()) conn->session.checkpoint_dir = &opts_.checkpoint_dir;
+
+        // EPOLLOUT is edge-triggered too, so it only fires when a full
+        // send buffer gains room again.
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.fd = client_fd;
+        if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, client_fd, &ev) < 0) {
+            perror("epoll_ctl client");
+            ::close(client_fd);
+            ConnectionSlots::instance().release();
+            continue;
+        }
+        conns_[client_fd] = std::move(conn);
+        Metrics::instance().connection_opened();
+    }
+}
+
+// Over max_connections: say so, best effort, and hang up. The socket
+// is fresh, so the short reply fits its send buffer.
+void Reactor::refuse_connection(int client_fd) {
+    std::string frame;
+    append_frame(frame, busy_reply("too many connections", OVERLOAD_RETRY_MS), opts_.protocol);
+    ssize_t sent = ::send(client_fd, frame.data(), frame.size(), MSG_NOSIGNAL);
+    (void)sent;
+    ::close(client_fd);
+    Metrics::instance().record_shed(Shed::Connection);
+}
+
+bool Reactor::can_read(const Connection& conn) const {
+    return conn.inflight.load() < opts_.max_inflight &&
+           conn.out_pending.load() < opts_.max_output_bytes;
+}
+
+void Reactor::on_readable(const std::shared_ptr<Connection>& conn) {
+    if (conn->eof) return;
+
+    std::vector<std::shared_ptr<Request>> reqs;
+    bool eof = false;
+    bool too_long = false;
+    LineReader& reader = conn->reader;
+
+    // Edge-triggered: keep reading until the kernel buffer is empty, or
+    // until the in-flight budget is used up. Messages are cut after every
+    // chunk so the buffer only ever holds one partial message.
+    while (true) {
+        LineReader::Status st = LineReader::Status::NeedMore;
+        std::string payload;
+        while (can_read(*conn)) {
+            bool binary = is_binary(conn->framing);
+            st = binary ? reader.next_frame(payload) : reader.next_line(payload);
+            if (st != LineReader::Status::Ready) break;
+            if (!binary && is_blank_line(payload)) continue;
+            conn->inflight.fetch_add(1);
+            reqs.push_back(accept_message(*conn, std::move(payload)));
+        }
+        if (st == LineReader::Status::TooLong) {
+            too_long = true;
+            break;
+        }
+        if (!can_read(*conn)) {
+            // Leave the rest in the kernel; maybe_resume() picks it up.
+            // Re-check after publishing the flag in case a worker caught
+            // up in between.
+            conn->read_paused.store(true);
+            if (can_read(*conn) && conn->read_paused.exchange(false)) continue;
+            break;
+        }
+
+        ssize_t n;
+        {
+            StageTimer timer(Stage::Read);
+            n = reader.fill(conn->fd);
+        }
+        if (n > 0) Metrics::instance().add_bytes_in(static_cast<size_t>(n));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("recv");
+                eof = true;
+            }
+            break;
+        }
+        if (n == 0) {
+            eof = true;
+            break;
+        }
+    }
+
+    if (too_long) {
+        // The stream cannot be resynchronised reliably; answer and hang up.
+        eof = true;
+    } else if (eof && reader.buffered() > 0 && !is_binary(conn->framing)) {
+        // a final line without its newline still counts
+        std::string rest = reader.take_rest();
+        if (!is_blank_line(rest)) {
+            conn->inflight.fetch_add(1);
+            reqs.push_back(accept_message(*conn, std::move(rest)));
+        }
+    }
+    conn->eof = eof;
+
+    bool schedule = false;
+    std::vector<std::shared_ptr<Request>> answered_now;
+    {
+        std::lock_guard<std::mutex> lock(conn->mu);
+        if (conn->closing) return;
+        for (auto& req : reqs) {
+            // With nothing ahead of it, a request answered up front does
+            // not wait for a worker; under overload that is the point.
+            if (req->answered && conn->pending.empty() && !conn->draining) {
+                answered_now.push_back(req);
+                continue;
+            }
+            conn->pending.push_back(req);
+        }
+        if (eof) conn->peer_closed = true;
+        if (too_long) conn->overflowed = true;
+        bool head_ready = !conn->pending.empty() && conn->pending.front()->parsed;
+        if ((eof || head_ready) && !conn->draining) {
+            conn->draining = true;
+            schedule = true;
+        }
+    }
+    for (auto& req : answered_now) {
+        std::string frame;
+        append_frame(frame, req->reply, req->framing);
+        write_bytes(conn, frame);
+        conn->inflight.fetch_sub(1);
+    }
+    if (!answered_now.empty()) maybe_resume(conn);
+    for (auto& req : reqs) {
+        if (!req->parsed) pool_.submit([this, conn, req] { parse(conn, req); });
+    }
+    if (schedule) {
+        pool_.submit([this, conn] { drain(conn); });
+    }
+}
+
+// Wraps one incoming message. Protocol switches are handled right here
+// rather than on a worker, because they change how the very next bytes
+// are cut; only a message that peeks as one is decoded in full.
+std::shared_ptr<Request> Reactor::accept_message(Connection& conn, std::string payload) {
+    auto req = std::make_shared<Request>(std::move(payload), conn.framing);
+    if (may_be_protocol_command(req->payload) && peek_request(req->payload, req->framing).protocol) {
+        json cmd = decode_payload(req->payload, req->framing);
+        if (negotiate_framing(cmd, conn.framing, req->reply)) {
+            auto id = cmd.find("id");
+            if (id != cmd.end()) tag_reply(req->reply, *id);
+            req->answered = true;
+            req->parsed = true;
+            req->payload = std::string();
+        }
+    }
+    if (!req->answered) admit(conn, *req);
+    return req;
+}
+
+// Turns `req` away if its connection is over its request rate or the
+// pool is past server.shed_queue_depth, by answering it up front.
+void Reactor::admit(Connection& conn, Request& req) {
+    const bool rate_limited = opts_.max_request_rate > 0.0;
+    if (!rate_limited && opts_.shed_queue_depth == 0) return;
+
+    // A cancel passes without spending a token, so it is found before
+    // the bucket is touched; only messages that may be one are peeked.
+    RequestPeek peek;
+    bool peeked = may_be_cancel(req.payload);
+    if (peeked) {
+        peek = peek_request(req.payload, req.framing);
+        if (peek.cancel) return;
+    }
+
+    const char* reason = nullptr;
+    long retry_after_ms = 0;
+    Shed shed = Shed::Count;
+    if (rate_limited && !conn.limiter.take(metrics_now_ns())) {
+        reason = "rate limit";
+        retry_after_ms = conn.limiter.retry_after_ms();
+        shed = Shed::RateLimit;
+    } else if (opts_.shed_queue_depth > 0 && pool_.queued() > opts_.shed_queue_depth) {
+        reason = "overloaded";
+        retry_after_ms = OVERLOAD_RETRY_MS;
+        shed = Shed::Overload;
+    }
+    if (!reason) return;
+
+    if (!peeked) peek = peek_request(req.payload, req.framing);
+    req.reply = busy_reply(reason, retry_after_ms);
+    if (!peek.id.is_discarded()) tag_reply(req.reply, peek.id);
+    req.answered = true;
+    req.parsed = true;
+    req.payload = std::string();
+    Metrics::instance().record_shed(shed);
+}
+
+void Reactor::on_writable(const std::shared_ptr<Connection>& conn) {
+    bool close_now = false;
+    {
+        std::lock_guard<std::mutex> lock(conn->out_mu);
+        if (conn->fd_closed || conn->out_off >= conn->outbuf.size()) return;
+        bool ok = flush_locked(*conn);
+        close_now = !ok || (conn->close_after_flush && conn->out_off >= conn->outbuf.size());
+    }
+    if (close_now) {
+        close_connection(conn);
+        return;
+    }
+    maybe_resume(conn);
+    if (conn->stream_parked.load() && conn->out_pending.load() < stream_high_water() &&
+        conn->stream_parked.exchange(false)) {
+        pool_.submit([this, conn] { drain(conn); });
+    }
+}
+
+// Worker side: parse one line. If that unblocks the head of the queue,
+// keep going and run it on this thread.
+void Reactor::parse(const std::shared_ptr<Connection>& conn, const std::shared_ptr<Request>& req) {
+    json cmd;
+    bool fast = false;
+    {
+        StageTimer timer(Stage::Parse);
+        fast = conn->typed && parse_fast_update(req->payload.data(), req->payload.size(), req->framing,
+                                                *conn->typed, req->fast_update);
+        if (!fast) cmd = decode_payload(req->payload, req->framing);
+    }
+    bool run_now = false;
+    {
+        std::lock_guard<std::mutex> lock(conn->mu);
+        req->cmd = std::move(cmd);
+        req->fast = fast;
+        // A fast update keeps its payload in case delta mode needs the DOM.
+        if (!fast) req->payload = std::string();
+        req->parsed = true;
+        if (!conn->draining && !conn->closing &&
+            !conn->pending.empty() && conn->pending.front()->parsed) {
+            conn->draining = true;
+            run_now = true;
+        }
+    }
+    if (run_now) drain(conn);
+}
+
+// Worker side: run parsed requests off the front of the queue until the
+// queue is empty or its head is still being parsed, then give the
+// connection back. If the peer is gone, ask the reactor to close it.
+void Reactor::drain(const std::shared_ptr<Connection>& conn) {
+    // A parked stream is still the head request; finish it first.
+    if (conn->session.stream) {
+        bool finished = true;
+        try {
+            finished = pump_stream(conn);
+        } catch (const std::exception& e) {
+            answer_failure(conn, e.what(), conn->stream_framing,
+                           conn->stream_id.is_discarded() ? nullptr : &conn->stream_id);
+        }
+        if (!finished) return;
+    }
+
+    while (true) {
+        std::shared_ptr<Request> req;
+        bool overflowed = false;
+        Framing framing = Framing::Ndjson;
+        {
+            std::lock_guard<std::mutex> lock(conn->mu);
+            if (!conn->pending.empty() && conn->pending.front()->parsed) {
+                req = std::move(conn->pending.front());
+                conn->pending.pop_front();
+            } else {
+                conn->draining = false;
+                if (!conn->pending.empty() || !conn->peer_closed || conn->closing ||
+                    conn->async_running > 0) {
+                    return;
+                }
+                conn->closing = true;
+                overflowed = conn->overflowed;
+                framing = conn->framing;
+            }
+        }
+
+        if (!req) {
+            if (overflowed) {
+                // Best effort: the connection closes either way.
+                try {
+                    write_reply(conn, json{{"error", "message too long"}}, framing);
+                } catch (const std::exception&) {}
+            }
+            post(to_close_, conn);
+            return;
+        }
+
+        Served served = Served::Elsewhere;
+        try {
+            served = serve(conn, req);
+        } catch (const std::exception& e) {
+            answer_failure(conn, e.what(), req->framing, request_id(*req));
+            continue;
+        }
+        if (served == Served::Parked) return;  // this worker lets go
+        if (served == Served::Replied) {
+            conn->inflight.fetch_sub(1);
+            maybe_resume(conn);
+        }
+    }
+}
+
+// Worker side, from drain(): one request taken off the queue.
+Reactor::Served Reactor::serve(const std::shared_ptr<Connection>& conn, const std::shared_ptr<Request>& req) {
+    if (req->fast && conn->session.has_state) {
+        // Delta mode caches the full state, so this update needs the DOM.
+        req->cmd = decode_payload(req->payload, req->framing);
+        req->fast = false;
+    }
+    req->payload = std::string();
+
+    const json* id = request_id(*req);
+    if (!req->answered && (req->fast || req->cmd.is_object())) {
+        json reply(json::value_t::discarded);
+        if (!req->fast && is_command(req->cmd, "cancel")) {
+            reply = cancel_async(*conn, req->cmd);  // with or without an id of its own
+        } else if (req->fast ? id != nullptr && allows_concurrent_calls(*conn->process)  // a plain update
+                             : is_async_request(req->cmd, *conn->process, conn->session)) {
+            reply = start_async(conn, req);
+            if (reply.is_discarded()) return Served::Elsewhere;  // answered when it is done
+        }
+        if (!reply.is_discarded()) {
+            if (id) tag_reply(reply, *id);
+            write_reply(conn, reply, req->framing);
+            return Served::Replied;
+        }
+    }
+
+    // Cached schema replies have no room for an id.
+    if (!req->answered && !req->fast && !req->cmd.is_discarded() && !id) {
+        if (auto bytes = cached_reply(req->cmd, *conn->process, req->framing)) {
+            write_bytes(conn, *bytes);
+            return Served::Replied;
+        }
+    }
+
+    // A repeated deterministic update: no update() and, without an id,
+    // no serialization either.
+    ResultKey key;
+    bool cacheable = !req->answered && request_result_key(*req, *conn->process, &conn->session, key);
+    if (cacheable) {
+        if (auto hit = ResultCache::instance().find(key)) {
+            if (id) {
+                json reply = hit->result();
+                tag_reply(reply, *id);
+                write_reply(conn, reply, req->framing);
+            } else {
+                write_bytes(conn, hit->frame(req->framing));
+            }
+            return Served::Replied;
+        }
+    }
+
+    json result;
+    if (req->answered) {
+        result = std::move(req->reply);
+    } else if (req->fast) {
+        try {
+            result = run_fast_update(*conn->typed, req->fast_update);
+        } catch (const std::exception& e) {
+            result = json{{"error", e.what()}};
+        }
+    } else if (req->cmd.is_discarded()) {
+        result = req->framing == Framing::Ndjson
+                     ? invalid_json_reply()
+                     : json{{"error", std::string("invalid ") + framing_name(req->framing)}};
+    } else {
+        try {
+            result = run_command(req->cmd, *conn->process, &conn->session);
+        } catch (const std::exception& e) {
+            result = json{{"error", e.what()}};
+        }
+    }
+    if (result.is_discarded() && conn->session.stream) {
+        conn->stream_framing = req->framing;
+        conn->stream_id = id ? *id : json(json::value_t::discarded);
+        // A finished stream has already counted itself answered.
+        return pump_stream(conn) ? Served::Elsewhere : Served::Parked;
+    }
+    if (cacheable) ResultCache::instance().insert(std::move(key), result);
+    if (id) tag_reply(result, *id);
+    write_reply(conn, result, req->framing);
+    return Served::Replied;
+}
+
+// Worker side: a request whose handling threw outside its command, say
+// while serializing the reply, still gets an answer and stops counting
+// as in flight, so the queue moves on and the connection can close. If
+// even that fails, the connection is given up.
+void Reactor::answer_failure(const std::shared_ptr<Connection>& conn, const char* what, Framing framing,
+                             const json* id) {
+    bool stream = conn->session.stream != nullptr;
+    conn->session.stream.reset();
+    try {
+        json reply = stream ? json{{"error", what}, {"done", true}} : json{{"error", what}};
+        if (id) tag_reply(reply, *id);
+        write_reply(conn, reply, framing);
+    } catch (const std::exception&) {
+        mark_broken(conn);
+    }
+    conn->inflight.fetch_sub(1);
+    maybe_resume(conn);
+}
+
+// One async request on its way through the pool.
+struct AsyncCall {
+    std::shared_ptr<Request> req;
+    std::shared_ptr<CancelToken> token;
+    std::string key;                // in Connection::async_tokens
+    Process* process = nullptr;     // what it runs against
+    std::unique_ptr<Process> own;   // a spare instance, if `process` is not shared
+};
+
+// Worker side, from drain(): hands `req` to a pool task of its own.
+// Returns the error reply if it cannot run asynchronously, else a
+// discarded value.
+json Reactor::start_async(const std::shared_ptr<Connection>& conn, const std::shared_ptr<Request>& req) {
+    if (!req->fast) {
+        json error = async_request_error(req->cmd, conn->session);
+        if (!error.is_discarded()) return error;
+    }
+
+    auto call = std::make_shared<AsyncCall>();
+    call->req = req;
+    call->token = std::make_shared<CancelToken>();
+    call->key = request_id(*req)->dump();
+    bool borrow = !allows_concurrent_calls(*conn->process);
+    {
+        std::lock_guard<std::mutex> lock(conn->mu);
+        if (!conn->async_tokens.emplace(call->key, call->token).second) {
+            return json{{"error", "id already in flight"}};
+        }
+        ++conn->async_running;
+        if (borrow && !conn->spare_processes.empty()) {
+            call->own = std::move(conn->spare_processes.back());
+            conn->spare_processes.pop_back();
+        }
+    }
+    try {
+        if (borrow && !call->own) call->own = factory_();
+        call->process = borrow ? call->own.get() : conn->process.get();
+        pool_.submit([this, conn, call] { run_async(conn, *call); });
+    } catch (...) {
+        // Not started after all; drain() answers it with the error.
+        std::lock_guard<std::mutex> lock(conn->mu);
+        conn->async_tokens.erase(call->key);
+        --conn->async_running;
+        if (call->own) conn->spare_processes.push_back(std::move(call->own));
+        throw;
+    }
+    return json(json::value_t::discarded);
+}
+
+void Reactor::run_async(const std::shared_ptr<Connection>& conn, AsyncCall& call) {
+    const Request& req = *call.req;
+    json result;
+    if (call.token->cancelled() || conn->broken.load()) {
+        result = json{{"error", "cancelled"}};
+    } else {
+        CancelScope scope(call.token.get());
+        ResultKey key;
+        bool cacheable = request_result_key(req, *call.process, nullptr, key);
+        auto hit = cacheable ? ResultCache::instance().find(key) : nullptr;
+        try {
+            if (hit) {
+                result = hit->result();
+            } else if (req.fast) {
+                // `process` is the connection's or a clone of it, so typed too.
+                result = run_fast_update(dynamic_cast<TypedProcess&>(*call.process), req.fast_update);
+            } else {
+                Session session;  // a fresh one: async requests share nothing with the queue
+                session.pool = &pool_;
+                result = run_command(req.cmd, *call.process, &session);
+            }
+            if (cacheable && !hit) ResultCache::instance().insert(std::move(key), result);
+        } catch (const std::exception& e) {
+            result = json{{"error", e.what()}};
+        }
+    }
+    // Serialized here rather than in conn->staging, which belongs to the
+    // worker that is draining the queue.
+    std::string frame;
+    try {
+        StageTimer timer(Stage::Serialize);
+        tag_reply(result, *request_id(req));
+        append_frame(frame, result, req.framing);
+    } catch (const std::exception& e) {
+        frame.clear();
+        json error{{"error", e.what()}};
+        tag_reply(error, *request_id(req));
+        append_frame(frame, error, req.framing);
+    }
+    write_bytes(conn, frame);
+    conn->inflight.fetch_sub(1);
+    maybe_resume(conn);
+
+    // The queue may have been waiting for this to close the connection.
+    bool run_queue = false;
+    {
+        std::lock_guard<std::mutex> lock(conn->mu);
+        conn->async_tokens.erase(call.key);
+        --conn->async_running;
+        if (call.own) conn->spare_processes.push_back(std::move(call.own));
+        if (!conn->draining && !conn->closing) {
+            conn->draining = true;
+            run_queue = true;
+        }
+    }
+    if (run_queue) drain(conn);
+}
+
+// {"command": "cancel", "arguments": {"id": ...}} replies
+// {"cancelled": true} if that async request was still running or queued.
+json Reactor::cancel_async(Connection& conn, const json& cmd) {
+    auto args = cmd.find("arguments");
+    if (args == cmd.end() || !args->is_object() || !args->contains("id")) {
+        return json{{"error", "cancel expects an 'id'"}};
+    }
+    std::string key = args->at("id").dump();
+    std::lock_guard<std::mutex> lock(conn.mu);
+    auto it = conn.async_tokens.find(key);
+    if (it == conn.async_tokens.end()) return json{{"cancelled", false}};
+    it->second->cancel();
+    return json{{"cancelled", true}};
+}
+
+void Reactor::cancel_all_async(Connection& conn) {
+    for (auto& entry : conn.async_tokens) entry.second->cancel();
+}
+
+size_t Reactor::stream_high_water() const {
+    return std::min(opts_.max_output_bytes, STREAM_HIGH_WATER);
+}
+
+// Worker side: writes frames of the session's stream until it ends and
+// returns true, or until the client falls behind by stream_high_water()
+// bytes and returns false. A parked stream keeps the connection marked
+// as draining, so nothing after it runs; on_writable() hands it back to
+// a worker once the socket has taken enough.
+bool Reactor::pump_stream(const std::shared_ptr<Connection>& conn) {
+    const size_t high = stream_high_water();
+    RunStream& stream = *conn->session.stream;
+    json frame;
+    bool more = true;
+    while (more && !conn->broken.load()) {
+        if (conn->out_pending.load() >= high) {
+            conn->stream_parked.store(true);
+            if (conn->out_pending.load() < high && conn->stream_parked.exchange(false)) continue;
+            return false;
+        }
+        try {
+            more = stream.next(frame);
+        } catch (const std::exception& e) {
+            frame = json{{"error", e.what()}, {"done", true}};
+            more = false;
+        }
+        if (!conn->stream_id.is_discarded()) tag_reply(frame, conn->stream_id);
+        write_reply(conn, frame, conn->stream_framing);
+    }
+    conn->session.stream.reset();
+    conn->inflight.fetch_sub(1);
+    maybe_resume(conn);
+    return true;
+}
+
+void Reactor::maybe_resume(const std::shared_ptr<Connection>& conn) {
+    if (conn->read_paused.load() && can_read(*conn) && conn->read_paused.exchange(false)) {
+        post(to_resume_, conn);
+    }
+}
+
+void Reactor::write_reply(const std::shared_ptr<Connection>& conn, const json& reply, Framing framing) {
+    {
+        // Serialize outside the lock so the reactor can keep flushing
+        // earlier replies meanwhile. When nothing is queued (the usual
+        // case) the staged bytes become the output buffer by a swap
+        // rather than a copy, and the old buffer is kept for next time.
+        std::string& staging = conn->staging;
+        staging.clear();
+        {
+            StageTimer timer(Stage::Serialize);
+            append_frame(staging, reply, framing);
+        }
+
+        std::lock_guard<std::mutex> lock(conn->out_mu);
+        if (conn->fd_closed) return;
+        if (conn->out_off >= conn->outbuf.size()) {
+            conn->outbuf.swap(staging);
+            conn->out_off = 0;
+        } else {
+            conn->outbuf.append(staging);
+        }
+        bool ok = flush_locked(*conn);
+        if (staging.capacity() > RETAIN_BUFFER_BYTES) std::string().swap(staging);
+        if (ok) return;
+    }
+    mark_broken(conn);
+}
+
+void Reactor::write_bytes(const std::shared_ptr<Connection>& conn, const std::string& frame) {
+    {
+        std::lock_guard<std::mutex> lock(conn->out_mu);
+        if (conn->fd_closed) return;
+        conn->outbuf.append(frame);
+        if (flush_locked(*conn)) return;
+    }
+    mark_broken(conn);
+}
+
+// The peer is unreachable: drop whatever is still queued.
+void Reactor::mark_broken(const std::shared_ptr<Connection>& conn) {
+    conn->broken.store(true);
+    {
+        std::lock_guard<std::mutex> lock(conn->mu);
+        conn->pending.clear();
+        conn->peer_closed = true;
+        conn->closing = true;
+        cancel_all_async(*conn);
+    }
+    post(to_close_, conn);
+}
+
+bool Reactor::flush_locked(Connection& conn) {
+    StageTimer timer(Stage::Send);
+    while (conn.out_off < conn.outbuf.size()) {
+        ssize_t n = ::send(conn.fd, conn.outbuf.data() + conn.out_off,
+                           conn.outbuf.size() - conn.out_off, MSG_NOSIGNAL);
+        if (n > 0) {
+            conn.out_off += static_cast<size_t>(n);
+            Metrics::instance().add_bytes_out(static_cast<size_t>(n));
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // Drop the sent prefix once it outweighs the unsent tail.
+            if (conn.out_off > conn.outbuf.size() / 2) {
+                conn.outbuf.erase(0, conn.out_off);
+                conn.out_off = 0;
+            }
+            conn.out_pending.store(conn.outbuf.size() - conn.out_off);
+            return true;
+        }
+        perror("send");
+        conn.outbuf.clear();
+        conn.out_off = 0;
+        conn.out_pending.store(0);
+        return false;
+    }
+    conn.outbuf.clear();
+    if (conn.outbuf.capacity() > RETAIN_BUFFER_BYTES) std::string().swap(conn.outbuf);
+    conn.out_off = 0;
+    conn.out_pending.store(0);
+    return true;
+}
+
+void Reactor::post(std::vector<std::shared_ptr<Connection>>& queue, const std::shared_ptr<Connection>& conn) {
+    {
+        std::lock_guard<std::mutex> lock(post_mu_);
+        queue.push_back(conn);
+    }
+    uint64_t one = 1;
+    ssize_t ignored = ::write(wake_fd_, &one, sizeof(one));
+    (void)ignored;
+}
+
+void Reactor::handle_posted() {
+    uint64_t count;
+    while (::read(wake_fd_, &count, sizeof(count)) > 0) {
+    }
+
+    std::vector<std::shared_ptr<Connection>> closes;
+    std::vector<std::shared_ptr<Connection>> resumes;
+    {
+        std::lock_guard<std::mutex> lock(post_mu_);
+        closes.swap(to_close_);
+        resumes.swap(to_resume_);
+    }
+
+    for (auto& conn : resumes) {
+        auto it = conns_.find(conn->fd);
+        if (it != conns_.end() && it->second == conn) on_readable(conn);
+    }
+    for (auto& conn : closes) {
+        bool flushed;
+        {
+            std::lock_guard<std::mutex> lock(conn->out_mu);
+            flushed = conn->out_off >= conn->outbuf.size();
+            if (!flushed) conn->close_after_flush = true;
+        }
+        // Unsent replies go out first; on_writable() closes afterwards.
+        if (flushed) close_connection(conn);
+    }
+}
+
+void Reactor::close_connection(const std::shared_ptr<Connection>& conn) {
+    auto it = conns_.find(conn->fd);
+    if (it == conns_.end() || it->second != conn) return;
+    {
+        std::lock_guard<std::mutex> lock(conn->out_mu);
+        conn->fd_closed = true;
+        ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, conn->fd, nullptr);
+        ::close(conn->fd);
+    }
+    conns_.erase(it);
+    ConnectionSlots::instance().release();
+    Metrics::instance().connection_closed();
+}
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "admission.hpp"
+#include "cancel.hpp"
+#include "config.hpp"
+#include "fast_update.hpp"
+#include "framing.hpp"
+#include "line_reader.hpp"
+#include "process.hpp"
+#include "protocol.hpp"
+#include "typed_process.hpp"
+#include "worker_pool.hpp"
+
+// ----------------------- Reactor ---------------------------------
+// A Reactor is one epoll thread that owns its listening sockets (TCP
+// and/or Unix domain) and every client fd accepted from them. With
+// server.acceptors > 1 there is one Reactor per acceptor, each with its
+// own SO_REUSEPORT listener so the kernel spreads new connections over
+// them; all of them share one WorkerPool.
+// Each connection is a three-stage pipeline:
+//
+//   read   the reactor cuts incoming bytes into messages (lines or
+//          length-prefixed frames, see framing.hpp) and queues them;
+//   parse  each message is decoded by its own pool task, so parsing of later
+//          requests overlaps with processing of earlier ones;
+//   run    one worker at a time takes parsed requests off the front of
+//          the queue and runs them against the connection's Process.
+//
+// Replies are appended to a per-connection output buffer in request
+// order and flushed without blocking; whatever the socket does not take
+// now is sent when epoll reports it writable. Reading pauses while the
+// connection has max_inflight requests queued or max_output_bytes of
+// unsent replies, which pushes back on the client through TCP. A
+// streaming reply (run with "stream": true) likewise stops producing
+// frames while the client is behind. Requests that admission control
+// (admission.hpp) turns away are answered at the read stage, without
+// being parsed or run.
+//
+// An async request (one with an id, see protocol.hpp) leaves the queue
+// as soon as it is reached: it runs on a pool task of its own and the
+// queue moves on, so a long computation does not hold up later requests
+// and one connection can keep several workers busy. Its reply goes out
+// whenever it is done. A process that allows concurrent calls is
+// shared with the queue; any other gets a separate instance from the
+// factory, kept for the connection's next async request.
+//
+// Once `running` turns false the reactor drains: it stops accepting and
+// reading, lets every request it already queued run and its reply go
+// out, and closes each connection as it empties. Whatever is left after
+// server.drain_timeout_ms is closed unanswered.
+
+struct Request {
+    Request(std::string payload, Framing framing)
+        : payload(std::move(payload)), framing(framing) {}
+
+    std::string payload;  // raw message, released once parsed (once run, if `fast`)
+    Framing framing;      // the reply goes out in the same framing
+    json cmd;             // discarded value if the payload did not decode
+    json reply;           // set up front for commands the reactor answers
+    FastUpdate fast_update;  // filled instead of cmd when `fast`
+    bool fast = false;
+    bool answered = false;
+    bool parsed = false;  // guarded by Connection::mu
+};
+
+struct AsyncCall;
+
+struct Connection {
+    Connection(int fd, std::unique_ptr<Process> process, size_t max_line, Framing framing)
+        : fd(fd), process(std::move(process)), typed(dynamic_cast<TypedProcess*>(this->process.get())),
+          reader(max_line), framing(framing) {}
+
+    const int fd;
+    std::unique_ptr<Process> process;
+    TypedProcess* const typed;  // `process`, if updates can take the fast path
+    Session session;  // used only by the worker that owns `process`
+
+    // reactor thread only
+    LineReader reader;
+    Framing framing;  // how the next incoming message is cut
+    bool eof = false;
+    RateLimiter limiter{0.0, 0.0};  // server.max_request_rate
+
+    std::atomic<bool> read_paused{false};
+    std::atomic<size_t> inflight{0};     // queued, not yet answered
+    std::atomic<size_t> out_pending{0};  // reply bytes not yet sent
+    std::atomic<bool> stream_parked{false};  // session.stream waits for the socket
+    std::atomic<bool> broken{false};         // a send failed; stop producing output
+    Framing stream_framing = Framing::Ndjson;  // owned like session
+    json stream_id{json::value_t::discarded};  // owned like session: tagged onto every frame
+    std::string staging;  // owned like session: the reply being serialized
+
+    std::mutex mu;  // guards the fields below
+    std::deque<std::shared_ptr<Request>> pending;  // in arrival order
+    bool draining = false;     // a worker currently owns `process`
+    bool peer_closed = false;  // no more input will be queued
+    bool overflowed = false;   // input stopped at a message over the limit
+    bool closing = false;      // handed back to the reactor to close
+    std::unordered_map<std::string, std::shared_ptr<CancelToken>> async_tokens;  // by id.dump()
+    size_t async_running = 0;  // the connection is not closed until these are answered
+    std::vector<std::unique_ptr<Process>> spare_processes;  // for async requests
+
+    std::mutex out_mu;  // guards the fields below
+    std::string outbuf;
+    size_t out_off = 0;        // bytes of outbuf already sent
+    bool fd_closed = false;    // the reactor has closed fd
+    bool close_after_flush = false;
+};
+
+// What a Reactor's drain got through; see Reactor::run().
+struct DrainReport {
+    size_t connections = 0;  // open when shutdown began
+    size_t requests = 0;     // queued on them, not yet answered
+    size_t completed = 0;    // of those, answered before the deadline
+    size_t abandoned = 0;    // connections still busy at the deadline and closed
+};
+
+class Reactor {
+public:
+    using ProcessFactory = std::function<std::unique_ptr<Process>()>;
+
+    Reactor(std::vector<int> listen_fds, const ServerOptions& opts, WorkerPool& pool,
+            ProcessFactory factory);
+    ~Reactor();
+
+    Reactor(const Reactor&) = delete;
+    Reactor& operator=(const Reactor&) = delete;
+
+    bool ok() const { return epoll_fd_ >= 0 && wake_fd_ >= 0; }
+
+    // Serves connections until `running` turns false, then drains them.
+    void run(const std::atomic<bool>& running);
+    const DrainReport& drain_report() const { return drain_report_; }
+
+private:
+    struct Listener {
+        int fd;
+        bool tcp;  // gets TCP_NODELAY on accepted sockets
+    };
+
+    bool poll(int timeout_ms);
+    void drain_connections();
+    void stop_reading(const std::shared_ptr<Connection>& conn);
+    void abandon(const std::shared_ptr<Connection>& conn);
+
+    const Listener* find_listener(int fd) const;
+    void accept_all(const Listener& listener);
+    void on_readable(const std::shared_ptr<Connection>& conn);
+    std::shared_ptr<Request> accept_message(Connection& conn, std::string payload);
+    void admit(Connection& conn, Request& req);
+    void refuse_connection(int client_fd);
+    void on_writable(const std::shared_ptr<Connection>& conn);
+    void parse(const std::shared_ptr<Connection>& conn, const std::shared_ptr<Request>& req);
+    void drain(const std::shared_ptr<Connection>& conn);
+    // Replied: the reply is written, the request still counts as in
+    // flight. Elsewhere: it went async, or a stream that counted itself.
+    // Parked: a stream waits for the socket and holds the connection.
+    enum class Served { Replied, Elsewhere, Parked };
+    Served serve(const std::shared_ptr<Connection>& conn, const std::shared_ptr<Request>& req);
+    void answer_failure(const std::shared_ptr<Connection>& conn, const char* what, Framing framing,
+                        const json* id);
+    bool pump_stream(const std::shared_ptr<Connection>& conn);
+    json start_async(const std::shared_ptr<Connection>& conn, const std::shared_ptr<Request>& req);
+    void run_async(const std::shared_ptr<Connection>& conn, AsyncCall& call);
+    json cancel_async(Connection& conn, const json& cmd);
+    void cancel_all_async(Connection& conn);  // requires conn.mu
+    size_t stream_high_water() const;
+
+    bool can_read(const Connection& conn) const;
+    void maybe_resume(const std::shared_ptr<Connection>& conn);
+
+    // Appends a reply frame and sends as much as the socket takes.
+    void write_reply(const std::shared_ptr<Connection>& conn, const json& reply, Framing framing);
+    // Same for a frame that is already serialized.
+    void write_bytes(const std::shared_ptr<Connection>& conn, const std::string& frame);
+    void mark_broken(const std::shared_ptr<Connection>& conn);
+    bool flush_locked(Connection& conn);  // requires conn.out_mu
+
+    void post(std::vector<std::shared_ptr<Connection>>& queue, const std::shared_ptr<Connection>& conn);
+    void handle_posted();
+    void close_connection(const std::shared_ptr<Connection>& conn);
+
+    std::vector<Listener> listeners_;
+    ServerOptions opts_;
+    int epoll_fd_ = -1;
+    int wake_fd_ = -1;
+    WorkerPool& pool_;
+    ProcessFactory factory_;
+
+    std::unordered_map<int, std::shared_ptr<Connection>> conns_;  // reactor thread only
+    DrainReport drain_report_;
+
+    // Requests from workers for the reactor thread, signalled via wake_fd_.
+    std::mutex post_mu_;
+    std::vector<std::shared_ptr<Connection>> to_close_;
+    std::vector<std::shared_ptr<Connection>> to_resume_;
+};
@@ -0,0 +1,45 @@
+#include "registry.hpp"
+
+#include "config.hpp"
+
+ProcessRegistry& ProcessRegistry::instance() {
+    static ProcessRegistry registry;
+    return registry;
+}
+
+bool ProcessRegistry::add(const std::string& name, ProcessBuilder builder) {
+    std::lock_guard<std::mutex> lock(mu_);
+    return builders_.emplace(name, std::move(builder)).second;
+}
+
+std::unique_ptr<Process> ProcessRegistry::build(const std::string& name, const json& cfg) const {
+    ProcessBuilder builder;
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        auto it = builders_.find(name);
+        if (it == builders_.end()) return nullptr;
+        builder = it->second;
+    }
+    return builder(cfg);
+}
+
+std::vector<std::string> ProcessRegistry::names() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    std::vector<std::string> out;
+    for (const auto& entry : builders_) out.push_back(entry.first);
+    return out;
+}
+
+std::string registered_process_names() {
+    std::string out;
+    for (const std::string& name : ProcessRegistry::instance().names()) {
+        if (!out.empty()) out += ", ";
+        out += name;
+    }
+    return out;
+}
+
+std::unique_ptr<Process> instantiate_process(const Process& prototype, const json& cfg) {
+    if (auto copy = prototype.clone()) return copy;
+    return build_process_from_config(cfg);
+}
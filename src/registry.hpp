@@ -0,0 +1,52 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "process.hpp"
+
+// ----------------------- Process registry ------------------------
+// Process types register a builder under the name used by the config's
+// "process" key. The server builds one prototype from the config at
+// startup and gives each connection a clone() of it, so the config is
+// walked once no matter how many connections arrive.
+
+// Builds a process from the whole config object. Throws
+// std::invalid_argument if the config cannot describe this process.
+using ProcessBuilder = std::function<std::unique_ptr<Process>(const json& cfg)>;
+
+class ProcessRegistry {
+public:
+    static ProcessRegistry& instance();
+
+    // Returns false if `name` is already taken.
+    bool add(const std::string& name, ProcessBuilder builder);
+
+    // nullptr if no process is registered under `name`.
+    std::unique_ptr<Process> build(const std::string& name, const json& cfg) const;
+
+    std::vector<std::string> names() const;
+
+private:
+    mutable std::mutex mu_;
+    std::map<std::string, ProcessBuilder> builders_;
+};
+
+// Registers a process type during static initialization, e.g.
+//   REGISTER_PROCESS("counter", [](const json& cfg) { ... });
+#define REGISTER_PROCESS_CONCAT2(a, b) a##b
+#define REGISTER_PROCESS_CONCAT(a, b) REGISTER_PROCESS_CONCAT2(a, b)
+#define REGISTER_PROCESS(name, builder)                                        \
+    static const bool REGISTER_PROCESS_CONCAT(process_registered_, __LINE__) = \
+        ProcessRegistry::instance().add(name, builder)
+
+// "a, b, c": the registered names, for unknown-process errors.
+std::string registered_process_names();
+
+// A per-connection instance: prototype.clone(), or a fresh build from the
+// config for processes that do not implement clone().
+std::unique_ptr<Process> instantiate_process(const Process& prototype, const json& cfg);
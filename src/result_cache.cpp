@@ -0,0 +1,151 @@
+#include "result_cache.hpp"
+
+#include <cstring>
+#include <typeinfo>
+#include <vector>
+
+#include "metrics.hpp"
+
+// ---- Keys ----
+
+// Eight bytes at a time with a multiply-xorshift per word and the
+// murmur3 finalizer at the end.
+static uint64_t hash_bytes(const std::string& bytes) {
+    const uint64_t mul = 0x9e3779b97f4a7c15ull;
+    uint64_t h = bytes.size() * mul;
+    const char* p = bytes.data();
+    std::size_t n = bytes.size();
+    for (; n >= 8; p += 8, n -= 8) {
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+        h = (h ^ word) * mul;
+        h ^= h >> 29;
+    }
+    if (n > 0) {
+        uint64_t word = 0;
+        std::memcpy(&word, p, n);
+        h = (h ^ word) * mul;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+template <class T>
+static void append_raw(std::string& bytes, const T& value) {
+    bytes.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Which process the result belongs to, and with which schemas.
+static void begin_key(const Process& process, double interval, ResultKey& key) {
+    key.bytes.clear();
+    append_raw(key.bytes, typeid(process).hash_code());
+    append_raw(key.bytes, process.schema_version());
+    append_raw(key.bytes, interval);
+}
+
+static bool cacheable(const Process& process) {
+    return ResultCache::instance().enabled() && process.deterministic();
+}
+
+bool result_key(const Process& process, const json& state, double interval, ResultKey& key) {
+    if (!cacheable(process) || !state.is_object()) return false;
+    if (auto typed = dynamic_cast<const TypedProcess*>(&process)) {
+        std::vector<double> in(typed->input_layout().size());
+        typed->read_inputs(state, in.data());
+        return result_key(*typed, in.data(), interval, key);
+    }
+    // Each declared port present in the state, in schema order, as its
+    // name and its value in MessagePack. Objects are sorted, so equal
+    // states give equal bytes however the client ordered its keys.
+    begin_key(process, interval, key);
+    const json schema = process.inputs();
+    for (auto port = schema.begin(); port != schema.end(); ++port) {
+        auto value = state.find(port.key());
+        if (value == state.end()) continue;
+        key.bytes += port.key();
+        key.bytes += '\0';
+        json::to_msgpack(*value, key.bytes);
+    }
+    key.hash = hash_bytes(key.bytes);
+    return true;
+}
+
+bool result_key(const TypedProcess& process, const double* in, double interval, ResultKey& key) {
+    if (!cacheable(process)) return false;
+    begin_key(process, interval, key);
+    key.bytes.append(reinterpret_cast<const char*>(in), process.input_layout().size() * sizeof(double));
+    key.hash = hash_bytes(key.bytes);
+    return true;
+}
+
+// ---- Cache ----
+
+const std::string& CachedResult::frame(Framing framing) const {
+    int f = static_cast<int>(framing);
+    std::call_once(serialized_[f], [&] { append_frame(frames_[f], result_, framing); });
+    return frames_[f];
+}
+
+ResultCache& ResultCache::instance() {
+    static ResultCache cache;
+    return cache;
+}
+
+void ResultCache::set_capacity(std::size_t entries) {
+    per_shard_.store(entries == 0 ? 0 : (entries + SHARDS - 1) / SHARDS, std::memory_order_relaxed);
+    clear();
+}
+
+std::shared_ptr<const CachedResult> ResultCache::find(const ResultKey& key) {
+    Metrics& metrics = Metrics::instance();
+    uint64_t start = metrics.enabled() ? metrics_now_ns() : 0;
+    std::shared_ptr<const CachedResult> found;
+    {
+        Shard& s = shard(key.hash);
+        std::lock_guard<std::mutex> lock(s.mu);
+        auto it = s.index.find(key.hash);
+        if (it != s.index.end() && it->second->first.bytes == key.bytes) {
+            s.lru.splice(s.lru.begin(), s.lru, it->second);
+            found = it->second->second;
+        }
+    }
+    metrics.record_result_cache(found != nullptr);
+    // A hit is the whole update, as far as the metrics go.
+    if (found && start) metrics.record_command(CommandKind::Update, metrics_now_ns() - start, false);
+    return found;
+}
+
+void ResultCache::insert(ResultKey key, const json& result) {
+    std::size_t capacity = per_shard_.load(std::memory_order_relaxed);
+    if (capacity == 0 || (result.is_object() && result.contains("error"))) return;
+    auto value = std::make_shared<const CachedResult>(result);
+
+    Shard& s = shard(key.hash);
+    std::lock_guard<std::mutex> lock(s.mu);
+    auto it = s.index.find(key.hash);
+    if (it != s.index.end()) {
+        // The same key raced in from another worker, or a hash collision:
+        // either way the newer result takes the slot.
+        s.lru.erase(it->second);
+        s.index.erase(it);
+    }
+    uint64_t hash = key.hash;
+    s.lru.emplace_front(std::move(key), std::move(value));
+    s.index.emplace(hash, s.lru.begin());
+    while (s.lru.size() > capacity) {
+        s.index.erase(s.lru.back().first.hash);
+        s.lru.pop_back();
+    }
+}
+
+void ResultCache::clear() {
+    for (Shard& s : shards_) {
+        std::lock_guard<std::mutex> lock(s.mu);
+        s.index.clear();
+        s.lru.clear();
+    }
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "framing.hpp"
+#include "process.hpp"
+#include "typed_process.hpp"
+
+// ----------------------- Result cache ----------------------------
+// Replies to plain updates of deterministic() processes, keyed by the
+// process type, the declared input ports of the state and the interval.
+// A hit skips update() and, when the request has no id, serialization
+// too: the reply frame is kept with the result. Bounded LRU, split into
+// shards by key hash so workers rarely wait on each other's lookups.
+//
+// Delta-mode updates, batches and runs are never cached. A restore
+// clears the cache, since it may change what update() computes.
+
+struct ResultKey {
+    uint64_t hash = 0;
+    std::string bytes;  // the canonical inputs; compared on every hit
+};
+
+// The key for an update of `process` with `state` (only its declared
+// input ports count), or false if the cache is off or the process is
+// not deterministic.
+bool result_key(const Process& process, const json& state, double interval, ResultKey& key);
+// The same from filled input slots; typed processes key on their slots
+// whichever way the request was parsed.
+bool result_key(const TypedProcess& process, const double* in, double interval, ResultKey& key);
+
+class CachedResult {
+public:
+    explicit CachedResult(json result) : result_(std::move(result)) {}
+
+    const json& result() const { return result_; }
+    // The result as a complete reply frame, serialized on first use.
+    const std::string& frame(Framing framing) const;
+
+private:
+    json result_;
+    mutable std::once_flag serialized_[3];
+    mutable std::string frames_[3];
+};
+
+class ResultCache {
+public:
+    static ResultCache& instance();
+
+    // Room for about `entries` results; 0 turns the cache off.
+    void set_capacity(std::size_t entries);
+    bool enabled() const { return per_shard_.load(std::memory_order_relaxed) > 0; }
+
+    // Counts a hit or a miss in the metrics.
+    std::shared_ptr<const CachedResult> find(const ResultKey& key);
+    // Error replies are not kept.
+    void insert(ResultKey key, const json& result);
+    void clear();
+
+private:
+    static const std::size_t SHARDS = 16;
+
+    using Entry = std::pair<ResultKey, std::shared_ptr<const CachedResult>>;
+    struct Shard {
+        std::mutex mu;
+        std::list<Entry> lru;  // most recently used first
+        std::unordered_map<uint64_t, std::list<Entry>::iterator> index;  // by key hash
+    };
+
+    Shard& shard(uint64_t hash) { return shards_[hash % SHARDS]; }
+
+    std::atomic<std::size_t> per_shard_{4096 / SHARDS};
+    Shard shards_[SHARDS];
+};
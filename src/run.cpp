@@ -0,0 +1,278 @@
+#include "run.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "cancel.hpp"
+#include "typed_process.hpp"
+
+// Refuse runs that would keep a worker busy more or less forever.
+static const long MAX_RUN_STEPS = 100000000;
+static const long CANCEL_CHECK_STEPS = 256;  // steps between looks at the cancel token
+
+Apply apply_rule(const json& port_schema) {
+    if (!port_schema.is_object()) return Apply::Set;
+    auto it = port_schema.find("_apply");
+    if (it == port_schema.end() || !it->is_string()) return Apply::Accumulate;
+    const std::string& rule = it->get_ref<const std::string&>();
+    if (rule == "set") return Apply::Set;
+    if (rule == "merge") return Apply::Merge;
+    if (rule == "null" || rule == "nothing") return Apply::Nothing;
+    return Apply::Accumulate;
+}
+
+// A schema entry with neither _type nor _apply describes nested ports.
+static bool is_nested_schema(const json& port_schema) {
+    return port_schema.is_object() && !port_schema.empty() &&
+           !port_schema.contains("_type") && !port_schema.contains("_apply");
+}
+
+void apply_update(json& state, const json& update, const json& output_schema) {
+    if (!update.is_object()) return;
+    if (!state.is_object()) state = json::object();
+
+    for (auto it = update.begin(); it != update.end(); ++it) {
+        const json* port = nullptr;
+        if (output_schema.is_object()) {
+            auto p = output_schema.find(it.key());
+            if (p != output_schema.end()) port = &*p;
+        }
+        if (!port) {
+            state[it.key()] = it.value();
+            continue;
+        }
+        if (is_nested_schema(*port) && it.value().is_object()) {
+            apply_update(state[it.key()], it.value(), *port);
+            continue;
+        }
+
+        json& current = state[it.key()];
+        switch (apply_rule(*port)) {
+        case Apply::Nothing:
+            break;
+        case Apply::Set:
+            current = it.value();
+            break;
+        case Apply::Merge:
+            if (current.is_object() && it.value().is_object()) {
+                current.merge_patch(it.value());
+            } else {
+                current = it.value();
+            }
+            break;
+        case Apply::Accumulate:
+            if (current.is_number() && it.value().is_number()) {
+                current = current.get<double>() + it.value().get<double>();
+            } else {
+                current = it.value();
+            }
+            break;
+        }
+    }
+}
+
+// ----------------------- Run plan --------------------------------
+
+bool plan_run(const json& args, RunPlan& plan, json& error) {
+    try {
+        if (args.contains("interval")) plan.dt = args.at("interval").get<double>();
+        if (args.contains("time")) plan.t0 = args.at("time").get<double>();
+        if (args.contains("stream")) plan.stream = args.at("stream").get<bool>();
+        // a stream emits every step unless told otherwise
+        if (plan.stream) plan.emit_every = 1;
+        if (args.contains("emit_every")) plan.emit_every = args.at("emit_every").get<long>();
+        if (args.contains("steps")) {
+            plan.steps = args.at("steps").get<long>();
+        } else if (args.contains("end_time")) {
+            plan.to_end = true;
+            plan.end = args.at("end_time").get<double>();
+        } else {
+            error = json{{"error", "run expects 'steps' or 'end_time'"}};
+            return false;
+        }
+    } catch (...) {
+        error = json{{"error", "invalid run arguments"}};
+        return false;
+    }
+
+    if (!(plan.dt > 0.0)) {
+        error = json{{"error", "run expects a positive 'interval'"}};
+        return false;
+    }
+    if (plan.to_end) {
+        double span = (plan.end - plan.t0) / plan.dt;
+        // tolerate rounding so end_time = t0 + n * dt gives exactly n steps
+        plan.steps = span > 0.0 ? static_cast<long>(std::ceil(span - 1e-9)) : 0;
+    }
+    if (plan.steps < 0 || plan.steps > MAX_RUN_STEPS) {
+        error = json{{"error", "run step count out of range"}};
+        return false;
+    }
+    return true;
+}
+
+// ----------------------- Simulations -----------------------------
+
+json Simulation::summary() const {
+    return json{
+        {"time", time()},
+        {"steps", steps_done()},
+        {"state", state()},
+    };
+}
+
+// Generic path: every step goes through Process::update and JSON.
+class JsonSimulation : public Simulation {
+public:
+    JsonSimulation(const RunPlan& plan, json state, Process& process)
+        : Simulation(plan), process_(process), schema_(process.outputs()), state_(std::move(state)) {}
+
+    json state() const override { return state_; }
+
+protected:
+    void advance(double interval) override {
+        json update = process_.update(state_, interval);
+        apply_update(state_, update, schema_);
+    }
+
+private:
+    Process& process_;
+    const json schema_;
+    json state_;
+};
+
+// Typed path: the state lives in double slots between steps, one slot
+// per port name across inputs and outputs.
+class TypedSimulation : public Simulation {
+public:
+    TypedSimulation(const RunPlan& plan, json initial, TypedProcess& process)
+        : Simulation(plan), process_(process), initial_(std::move(initial)) {
+        if (!initial_.is_object()) initial_ = json::object();
+        const StateLayout& in_layout = process.input_layout();
+        const StateLayout& out_layout = process.output_layout();
+        const json schema = process.outputs();
+
+        names_ = in_layout.names;
+        values_.resize(in_layout.size());
+        process.read_inputs(initial_, values_.data());
+        for (const auto& name : names_) shown_.push_back(is_number_in_initial(name));
+
+        out_slot_.resize(out_layout.size());
+        rule_.resize(out_layout.size());
+        for (size_t j = 0; j < out_layout.size(); ++j) {
+            const std::string& name = out_layout.names[j];
+            rule_[j] = apply_rule(schema.at(name));
+            if (rule_[j] == Apply::Merge) rule_[j] = Apply::Set;  // numbers merge by replacement
+            int s = in_layout.slot(name);
+            if (s < 0) {
+                s = static_cast<int>(names_.size());
+                bool present = is_number_in_initial(name);
+                names_.push_back(name);
+                values_.push_back(present ? initial_.at(name).get<double>() : 0.0);
+                shown_.push_back(present);
+            }
+            out_slot_[j] = static_cast<size_t>(s);
+        }
+        in_.resize(in_layout.size());
+        out_.resize(out_layout.size());
+    }
+
+    json state() const override {
+        json state = initial_;
+        for (size_t i = 0; i < names_.size(); ++i) {
+            if (shown_[i]) state[names_[i]] = values_[i];
+        }
+        return state;
+    }
+
+protected:
+    void advance(double interval) override {
+        std::copy(values_.begin(), values_.begin() + static_cast<long>(in_.size()), in_.begin());
+        std::fill(out_.begin(), out_.end(), 0.0);
+        process_.update_typed(in_.data(), out_.data(), interval);
+        for (size_t j = 0; j < out_.size(); ++j) {
+            switch (rule_[j]) {
+            case Apply::Set:        values_[out_slot_[j]] = out_[j]; break;
+            case Apply::Accumulate: values_[out_slot_[j]] += out_[j]; break;
+            default:                break;
+            }
+            if (rule_[j] != Apply::Nothing) shown_[out_slot_[j]] = true;
+        }
+    }
+
+private:
+    bool is_number_in_initial(const std::string& name) const {
+        auto it = initial_.find(name);
+        return it != initial_.end() && it->is_number();
+    }
+
+    TypedProcess& process_;
+    json initial_;                 // non-slot fields pass through unchanged
+    std::vector<std::string> names_;
+    std::vector<double> values_;
+    std::vector<bool> shown_;      // written back into state()
+    std::vector<size_t> out_slot_;
+    std::vector<Apply> rule_;
+    std::vector<double> in_;
+    std::vector<double> out_;
+};
+
+std::unique_ptr<Simulation> Simulation::create(const RunPlan& plan, const json& state, Process& process) {
+    if (auto* typed = dynamic_cast<TypedProcess*>(&process)) {
+        return std::make_unique<TypedSimulation>(plan, state, *typed);
+    }
+    return std::make_unique<JsonSimulation>(plan, state, process);
+}
+
+bool RunStream::next(json& frame) {
+    const RunPlan& plan = sim_->plan();
+    if (!started_) {
+        started_ = true;
+        if (plan.emits(0)) {
+            frame = sim_->point();
+            return true;
+        }
+    }
+    while (!sim_->finished()) {
+        if (sim_->steps_done() % CANCEL_CHECK_STEPS == 0) throw_if_cancelled();
+        sim_->step();
+        if (plan.emits(sim_->steps_done())) {
+            frame = sim_->point();
+            return true;
+        }
+    }
+    frame = sim_->summary();
+    frame["done"] = true;
+    return false;
+}
+
+json run_simulation(const json& args, Process& process, std::unique_ptr<RunStream>* stream) {
+    if (!args.is_object()) {
+        return json{{"error", "run expects an arguments object"}};
+    }
+    RunPlan plan;
+    json error;
+    if (!plan_run(args, plan, error)) return error;
+    if (plan.stream && !stream) {
+        return json{{"error", "run cannot stream on this connection"}};
+    }
+
+    auto sim = Simulation::create(plan, args.value("state", json::object()), process);
+    if (plan.stream) {
+        *stream = std::make_unique<RunStream>(std::move(sim));
+        return json(json::value_t::discarded);
+    }
+
+    json trajectory = json::array();
+    if (plan.emits(0)) trajectory.push_back(sim->point());
+    while (!sim->finished()) {
+        if (sim->steps_done() % CANCEL_CHECK_STEPS == 0) throw_if_cancelled();
+        sim->step();
+        if (plan.emits(sim->steps_done())) trajectory.push_back(sim->point());
+    }
+    json result = sim->summary();
+    if (plan.emit_every > 0) result["trajectory"] = std::move(trajectory);
+    return result;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <memory>
+
+#include "process.hpp"
+
+// ----------------------- Server-side runs ------------------------
+// `run` steps a process against its own outputs on the server, so a
+// many-step simulation costs one request instead of one per step.
+
+// How an output port's value is folded into the state ("_apply").
+enum class Apply {
+    Accumulate,  // add to the current value (the default)
+    Set,         // replace the current value
+    Merge,       // merge-patch objects into the current value
+    Nothing,     // leave the state alone
+};
+
+Apply apply_rule(const json& port_schema);
+
+// Folds `update` into `state` following the rules in `output_schema`.
+// Ports without a schema entry are set.
+void apply_update(json& state, const json& update, const json& output_schema);
+
+// run: {"state": {...}, "interval": dt, "steps": n | "end_time": t,
+//       "time": t0, "emit_every": k, "stream": bool}
+
+struct RunPlan {
+    double t0 = 0.0;
+    double dt = 0.0;
+    long steps = 0;
+    bool to_end = false;  // the last step is shortened to land on end
+    double end = 0.0;
+    long emit_every = 0;
+    bool stream = false;
+
+    // Time before step k.
+    double time(long k) const {
+        return (to_end && k == steps) ? end : t0 + static_cast<double>(k) * dt;
+    }
+    double interval(long k) const {
+        return (to_end && k == steps - 1) ? end - time(k) : dt;
+    }
+    // Whether the state after `done` steps is a trajectory point.
+    bool emits(long done) const {
+        return emit_every > 0 && (done % emit_every == 0 || done == steps);
+    }
+};
+
+// Reads a RunPlan out of run arguments; on failure fills `error` with
+// the reply and returns false.
+bool plan_run(const json& args, RunPlan& plan, json& error);
+
+// One run in progress: steps a process and folds each update back into
+// the state. Typed processes are stepped on their double slots and only
+// turned into JSON when state() is asked for.
+class Simulation {
+public:
+    static std::unique_ptr<Simulation> create(const RunPlan& plan, const json& state, Process& process);
+    virtual ~Simulation() = default;
+
+    const RunPlan& plan() const { return plan_; }
+    long steps_done() const { return done_; }
+    bool finished() const { return done_ >= plan_.steps; }
+    double time() const { return plan_.time(done_); }
+
+    void step() {
+        advance(plan_.interval(done_));
+        ++done_;
+    }
+    virtual json state() const = 0;
+
+    json point() const { return json{{"time", time()}, {"state", state()}}; }
+    // {"time", "steps", "state"} for the current step.
+    json summary() const;
+
+protected:
+    explicit Simulation(const RunPlan& plan) : plan_(plan) {}
+    virtual void advance(double interval) = 0;
+
+private:
+    RunPlan plan_;
+    long done_ = 0;
+};
+
+// Streams a run as separate frames: one {"time", "state"} point per
+// emitted step, then {"done": true, "time", "steps", "state"}. The
+// caller pulls frames as fast as the client takes them, so memory stays
+// flat however long the run is.
+class RunStream {
+public:
+    explicit RunStream(std::unique_ptr<Simulation> sim) : sim_(std::move(sim)) {}
+
+    // Fills the next frame; returns false once that was the final one.
+    bool next(json& frame);
+
+private:
+    std::unique_ptr<Simulation> sim_;
+    bool started_ = false;
+};
+
+// Returns {"time", "steps", "state"} and, when emit_every > 0, a
+// "trajectory" of {"time", "state"} points taken at step 0, every k-th
+// step and the last step. With "stream": true the run is instead handed
+// back through `stream` and a discarded value is returned.
+json run_simulation(const json& args, Process& process, std::unique_ptr<RunStream>* stream = nullptr);
@@ -0,0 +1,66 @@
+#include "schema_cache.hpp"
+
+#include <mutex>
+
+#include "metrics.hpp"
+
+static const Framing ALL_FRAMINGS[] = {Framing::Ndjson, Framing::MsgPack, Framing::Cbor};
+
+SchemaCache& SchemaCache::instance() {
+    static SchemaCache cache;
+    return cache;
+}
+
+std::shared_ptr<const std::string> SchemaCache::frame(const Process& process, SchemaKind kind, Framing framing) {
+    Key key{std::type_index(typeid(process)), process.schema_version()};
+    std::shared_ptr<const Entry> entry;
+    {
+        std::shared_lock<std::shared_mutex> lock(mu_);
+        auto it = entries_.find(key);
+        if (it != entries_.end()) entry = it->second;
+    }
+
+    if (!entry) {
+        // Build outside the lock; if two threads race the first one wins.
+        auto fresh = std::make_shared<Entry>();
+        const json schemas[2] = {process.inputs(), process.outputs()};
+        for (int k = 0; k < 2; ++k) {
+            for (Framing f : ALL_FRAMINGS) {
+                append_frame(fresh->frames[k][static_cast<int>(f)], schemas[k], f);
+            }
+        }
+        std::unique_lock<std::shared_mutex> lock(mu_);
+        entry = entries_.emplace(key, std::move(fresh)).first->second;
+    }
+
+    // Aliasing pointer: shares ownership of the entry, points at one frame.
+    const std::string* bytes = &entry->frames[static_cast<int>(kind)][static_cast<int>(framing)];
+    return std::shared_ptr<const std::string>(entry, bytes);
+}
+
+void SchemaCache::clear() {
+    std::unique_lock<std::shared_mutex> lock(mu_);
+    entries_.clear();
+}
+
+std::shared_ptr<const std::string> cached_reply(const json& cmd, const Process& process, Framing framing) {
+    if (!cmd.is_object()) return nullptr;
+    auto it = cmd.find("command");
+    if (it == cmd.end() || !it->is_string()) return nullptr;
+
+    const std::string& name = it->get_ref<const std::string&>();
+    SchemaKind kind;
+    if (name == "inputs") {
+        kind = SchemaKind::Inputs;
+    } else if (name == "outputs") {
+        kind = SchemaKind::Outputs;
+    } else {
+        return nullptr;
+    }
+
+    Metrics& metrics = Metrics::instance();
+    uint64_t start = metrics.enabled() ? metrics_now_ns() : 0;
+    auto frame = SchemaCache::instance().frame(process, kind, framing);
+    if (start) metrics.record_command(command_kind(name), metrics_now_ns() - start, false);
+    return frame;
+}
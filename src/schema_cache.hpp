@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <typeindex>
+#include <utility>
+
+#include "framing.hpp"
+#include "process.hpp"
+
+// ----------------------- Schema cache ----------------------------
+// The replies to `inputs` and `outputs`, serialized once per process
+// type in every framing. Entries are keyed by the process's dynamic
+// type and its schema_version(), so a process whose schema changes (or
+// depends on its configuration) only has to return a new version to
+// stop being served stale bytes.
+
+enum class SchemaKind { Inputs, Outputs };
+
+class SchemaCache {
+public:
+    static SchemaCache& instance();
+
+    // Complete reply frame (newline or length prefix included).
+    std::shared_ptr<const std::string> frame(const Process& process, SchemaKind kind, Framing framing);
+
+    // Drops every entry; the next request recomputes.
+    void clear();
+
+private:
+    struct Entry {
+        std::string frames[2][3];  // [kind][framing]
+    };
+    using Key = std::pair<std::type_index, uint64_t>;
+
+    std::shared_mutex mu_;
+    std::map<Key, std::shared_ptr<const Entry>> entries_;
+};
+
+// A cached reply for `cmd` if it is an inputs or outputs command.
+std::shared_ptr<const std::string> cached_reply(const json& cmd, const Process& process, Framing framing);
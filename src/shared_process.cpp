@@ -0,0 +1,95 @@
+#include "shared_process.hpp"
+
+#include <exception>
+#include <future>
+
+// ---- Instance ----
+
+SharedInstance::SharedInstance(std::unique_ptr<Process> process)
+    : process_(std::move(process)), mode_(process_->concurrency()) {
+    if (mode_ == Concurrency::ThreadAffine) {
+        executor_ = std::make_unique<WorkerPool>(1);
+    }
+}
+
+json SharedInstance::dispatch(const std::function<json(Process&)>& call) const {
+    switch (mode_) {
+    case Concurrency::Stateless:
+    case Concurrency::Reentrant:
+        return call(*process_);
+    case Concurrency::Serialized: {
+        std::lock_guard<std::mutex> lock(mu_);
+        return call(*process_);
+    }
+    case Concurrency::ThreadAffine:
+        break;
+    }
+
+    // The executor catches nothing on our behalf, so carry the result or
+    // the exception back through the promise.
+    std::promise<json> done;
+    std::future<json> result = done.get_future();
+    executor_->submit([&] {
+        try {
+            done.set_value(call(*process_));
+        } catch (...) {
+            done.set_exception(std::current_exception());
+        }
+    });
+    return result.get();
+}
+
+// ---- Handles ----
+
+std::unique_ptr<Process> SharedProcess::share(std::unique_ptr<Process> process) {
+    auto* batch = dynamic_cast<BatchProcess*>(process.get());
+    auto* typed = dynamic_cast<TypedProcess*>(process.get());
+    auto shared = std::make_shared<SharedInstance>(std::move(process));
+    if (batch) return std::make_unique<SharedBatchProcess>(std::move(shared), *batch);
+    if (typed) return std::make_unique<SharedTypedProcess>(std::move(shared), *typed);
+    return std::make_unique<SharedProcess>(std::move(shared));
+}
+
+json SharedProcess::update(const json& state, double interval) {
+    return shared_->dispatch([&](Process& p) { return p.update(state, interval); });
+}
+
+std::unique_ptr<Process> SharedProcess::clone() const {
+    return std::make_unique<SharedProcess>(*this);
+}
+
+SharedTypedProcess::SharedTypedProcess(std::shared_ptr<SharedInstance> shared, TypedProcess& typed)
+    : SharedHandle(std::move(shared), typed.input_layout(), typed.output_layout()), typed_(typed) {}
+
+void SharedTypedProcess::update_typed(const double* in, double* out, double interval) {
+    shared_->dispatch([&](Process&) {
+        typed_.update_typed(in, out, interval);
+        return json();
+    });
+}
+
+std::unique_ptr<Process> SharedTypedProcess::clone() const {
+    return std::make_unique<SharedTypedProcess>(*this);
+}
+
+SharedBatchProcess::SharedBatchProcess(std::shared_ptr<SharedInstance> shared, BatchProcess& batch)
+    : SharedHandle(std::move(shared), batch.input_layout(), batch.output_layout()), batch_(batch) {}
+
+void SharedBatchProcess::update_columns(const BatchColumns& batch) {
+    shared_->dispatch([&](Process&) {
+        batch_.update_columns(batch);
+        return json();
+    });
+}
+
+// The instance's own update_typed() may be cheaper than a batch of one.
+void SharedBatchProcess::update_typed(const double* in, double* out, double interval) {
+    shared_->dispatch([&](Process&) {
+        batch_.update_typed(in, out, interval);
+        return json();
+    });
+}
+
+std::unique_ptr<Process> SharedBatchProcess::clone() const {
+    return std::make_unique<SharedBatchProcess>(*this);
+}
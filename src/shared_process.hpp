@@ -0,0 +1,124 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include "batch_process.hpp"
+#include "process.hpp"
+#include "typed_process.hpp"
+#include "worker_pool.hpp"
+
+// ----------------------- Shared process --------------------------
+// With server.share_process on, one Process instance serves every
+// connection and each connection holds a handle to it. The handle
+// dispatches according to the instance's concurrency():
+//
+//   Stateless, Reentrant  calls go straight through, no locking;
+//   Serialized            calls take a mutex owned by the instance;
+//   ThreadAffine          calls run on a dedicated executor thread and
+//                         the caller waits for the result.
+//
+// A TypedProcess or BatchProcess instance gets a handle of the same kind,
+// so the fast update path, typed runs and columnar batches still reach
+// it; update_typed() and update_columns() go through the same dispatch.
+
+// The instance and whatever guards it, common to all of its handles.
+class SharedInstance {
+public:
+    explicit SharedInstance(std::unique_ptr<Process> process);
+
+    // For what does not depend on the instance's state.
+    const Process& process() const { return *process_; }
+    Concurrency mode() const { return mode_; }
+
+    json dispatch(const std::function<json(Process&)>& call) const;
+
+private:
+    std::unique_ptr<Process> process_;
+    Concurrency mode_;
+    mutable std::mutex mu_;                  // Serialized
+    std::unique_ptr<WorkerPool> executor_;   // ThreadAffine
+};
+
+// What every handle forwards, whichever Process base it has.
+template <class Base>
+class SharedHandle : public Base {
+public:
+    template <class... Args>
+    explicit SharedHandle(std::shared_ptr<SharedInstance> shared, Args&&... args)
+        : Base(std::forward<Args>(args)...), shared_(std::move(shared)) {}
+
+    json inputs() const override {
+        return shared_->dispatch([](Process& p) { return p.inputs(); });
+    }
+    json outputs() const override {
+        return shared_->dispatch([](Process& p) { return p.outputs(); });
+    }
+
+    // The handle is as safe to call concurrently as the dispatch makes
+    // it; guarded instances still run one call at a time.
+    Concurrency concurrency() const override {
+        Concurrency mode = shared_->mode();
+        return mode == Concurrency::ThreadAffine ? Concurrency::Serialized : mode;
+    }
+    uint64_t schema_version() const override { return shared_->process().schema_version(); }
+    bool deterministic() const override { return shared_->process().deterministic(); }
+
+    // Saves or replaces the state of the shared instance, for every handle.
+    void save_state(std::string& out) const override {
+        shared_->dispatch([&](Process& p) {
+            p.save_state(out);
+            return json();
+        });
+    }
+    void load_state(std::string_view image) override {
+        shared_->dispatch([&](Process& p) {
+            p.load_state(image);
+            return json();
+        });
+    }
+
+protected:
+    std::shared_ptr<SharedInstance> shared_;
+};
+
+class SharedProcess : public SharedHandle<Process> {
+public:
+    // Wraps `process` for sharing in a handle of its kind; handles for
+    // further connections come from clone().
+    static std::unique_ptr<Process> share(std::unique_ptr<Process> process);
+
+    using SharedHandle::SharedHandle;
+
+    json update(const json& state, double interval) override;
+    std::unique_ptr<Process> clone() const override;
+};
+
+// The layouts are copied from the instance, so only the typed calls
+// themselves are dispatched.
+class SharedTypedProcess : public SharedHandle<TypedProcess> {
+public:
+    SharedTypedProcess(std::shared_ptr<SharedInstance> shared, TypedProcess& typed);
+
+    void update_typed(const double* in, double* out, double interval) override;
+    int input_slot(const std::string& name) const override { return typed_.input_slot(name); }
+    std::unique_ptr<Process> clone() const override;
+
+private:
+    TypedProcess& typed_;
+};
+
+class SharedBatchProcess : public SharedHandle<BatchProcess> {
+public:
+    SharedBatchProcess(std::shared_ptr<SharedInstance> shared, BatchProcess& batch);
+
+    void update_columns(const BatchColumns& batch) override;
+    void update_typed(const double* in, double* out, double interval) override;
+    int input_slot(const std::string& name) const override { return batch_.input_slot(name); }
+    std::unique_ptr<Process> clone() const override;
+
+private:
+    BatchProcess& batch_;
+};
@@ -0,0 +1,338 @@
+#include "shm_transport.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <new>
+
+#include "fast_update.hpp"
+#include "metrics.hpp"
+#include "result_cache.hpp"
+#include "schema_cache.hpp"
+
+static const long WAIT_MS = 200;  // how often a blocked side rechecks `running`
+static const size_t MIN_RING_BYTES = 4096;
+
+// Waits up to WAIT_MS for `sem`; the caller rechecks its condition either way.
+static void timed_wait(sem_t* sem) {
+    timespec deadline{};
+    ::clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += WAIT_MS * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    while (::sem_timedwait(sem, &deadline) < 0 && errno == EINTR) {
+    }
+}
+
+ShmServer::ShmServer(std::string name, size_t ring_bytes, Framing framing, WorkerPool& pool,
+                     ProcessFactory factory, long drain_timeout_ms, std::string checkpoint_dir)
+    : name_(std::move(name)), framing_(framing), pool_(pool), factory_(std::move(factory)),
+      drain_timeout_ms_(drain_timeout_ms), checkpoint_dir_(std::move(checkpoint_dir)) {
+    if (name_.empty() || name_[0] != '/') name_.insert(0, 1, '/');
+    ring_bytes_ = std::max(MIN_RING_BYTES, ring_bytes & ~(SHM_ALIGN - 1));
+}
+
+ShmServer::~ShmServer() {
+    stop();
+}
+
+char* ShmServer::request_data() const {
+    return reinterpret_cast<char*>(header_ + 1);
+}
+
+char* ShmServer::reply_data() const {
+    return request_data() + ring_bytes_;
+}
+
+bool ShmServer::start(const std::atomic<bool>& running) {
+    ::shm_unlink(name_.c_str());  // a stale segment from an earlier run
+    int fd = ::shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        perror("shm_open");
+        return false;
+    }
+
+    mapped_bytes_ = sizeof(ShmHeader) + 2 * ring_bytes_;
+    if (::ftruncate(fd, static_cast<off_t>(mapped_bytes_)) < 0) {
+        perror("ftruncate");
+        ::close(fd);
+        ::shm_unlink(name_.c_str());
+        return false;
+    }
+    void* addr = ::mmap(nullptr, mapped_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        perror("mmap");
+        ::shm_unlink(name_.c_str());
+        return false;
+    }
+
+    header_ = new (addr) ShmHeader;
+    header_->version = SHM_VERSION;
+    header_->framing.store(static_cast<uint32_t>(framing_));
+    header_->reserved = 0;
+    header_->capacity = ring_bytes_;
+    for (ShmRing* ring : {&header_->request, &header_->reply}) {
+        ring->head.store(0);
+        ring->tail.store(0);
+        ::sem_init(&ring->data, /*pshared=*/1, 0);
+        ::sem_init(&ring->space, /*pshared=*/1, 0);
+    }
+    // Clients check the magic last, once everything else is in place.
+    std::atomic_thread_fence(std::memory_order_release);
+    header_->magic = SHM_MAGIC;
+
+    process_ = factory_();
+    typed_ = dynamic_cast<TypedProcess*>(process_.get());
+    session_.pool = &pool_;
+    if (!checkpoint_dir_.empty()) session_.checkpoint_dir = &checkpoint_dir_;
+    thread_ = std::thread([this, &running] { serve(running); });
+    return true;
+}
+
+void ShmServer::stop() {
+    if (thread_.joinable()) thread_.join();
+    if (header_) {
+        ::sem_destroy(&header_->request.data);
+        ::sem_destroy(&header_->request.space);
+        ::sem_destroy(&header_->reply.data);
+        ::sem_destroy(&header_->reply.space);
+        ::munmap(header_, mapped_bytes_);
+        ::shm_unlink(name_.c_str());
+        header_ = nullptr;
+    }
+}
+
+// Once `running` turns false, the requests already in the ring are still
+// answered, like a connection's queue, until server.drain_timeout_ms.
+void ShmServer::serve(const std::atomic<bool>& running) {
+    ShmRing& ring = header_->request;
+    while (running.load()) {
+        if (!serve_next(running)) timed_wait(&ring.data);
+    }
+
+    drain_deadline_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(drain_timeout_ms_);
+    const uint64_t end = ring.head.load(std::memory_order_acquire);
+    drain_report_.requests = queued_records(ring.tail.load(std::memory_order_relaxed), end);
+    while (ring.tail.load(std::memory_order_relaxed) < end && may_wait(running)) {
+        serve_next(running);
+    }
+    size_t unanswered = queued_records(ring.tail.load(std::memory_order_relaxed), end);
+    drain_report_.connections = drain_report_.requests > 0 ? 1 : 0;
+    drain_report_.abandoned = unanswered > 0 ? 1 : 0;
+    drain_report_.completed = drain_report_.requests - std::min(unanswered, drain_report_.requests);
+    session_.stream.reset();
+}
+
+// Records between `tail` and `head`, not counting wrap markers.
+size_t ShmServer::queued_records(uint64_t tail, uint64_t head) const {
+    const char* data = request_data();
+    size_t records = 0;
+    while (tail < head) {
+        size_t off = static_cast<size_t>(tail % ring_bytes_);
+        uint32_t len;
+        std::memcpy(&len, data + off, sizeof(len));
+        if (len == SHM_WRAP) {
+            tail += ring_bytes_ - off;
+            continue;
+        }
+        if (len > ring_bytes_ - off - sizeof(len)) break;
+        tail += shm_record_bytes(len);
+        ++records;
+    }
+    return records;
+}
+
+bool ShmServer::may_wait(const std::atomic<bool>& running) const {
+    return running.load() || std::chrono::steady_clock::now() < drain_deadline_;
+}
+
+// Consumes and answers the next record. Returns false if the ring is empty.
+bool ShmServer::serve_next(const std::atomic<bool>& running) {
+    ShmRing& ring = header_->request;
+    const char* data = request_data();
+
+    uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+    uint64_t head = ring.head.load(std::memory_order_acquire);
+    if (head == tail) return false;
+
+    size_t off = static_cast<size_t>(tail % ring_bytes_);
+    uint32_t len;
+    std::memcpy(&len, data + off, sizeof(len));
+    if (len == SHM_WRAP) {
+        ring.tail.store(tail + (ring_bytes_ - off), std::memory_order_release);
+        return true;
+    }
+    if (len > ring_bytes_ - off - sizeof(len) || shm_record_bytes(len) > head - tail) {
+        std::cerr << "shm: corrupt request record, dropping " << (head - tail) << " bytes\n";
+        ring.tail.store(head, std::memory_order_release);
+        ::sem_post(&ring.space);
+        return true;
+    }
+
+    // Requests are decoded in place, then their space is handed back
+    // before the command runs.
+    Framing framing = static_cast<Framing>(header_->framing.load());
+    const char* payload = data + off + sizeof(len);
+    Metrics::instance().add_bytes_in(len);
+    json cmd;
+    bool fast = false;
+    {
+        StageTimer timer(Stage::Parse);
+        fast = typed_ && !session_.has_state &&
+               parse_fast_update(payload, len, framing, *typed_, fast_update_);
+        if (!fast) cmd = decode_payload(payload, len, framing);
+    }
+    ring.tail.store(tail + shm_record_bytes(len), std::memory_order_release);
+    ::sem_post(&ring.space);
+
+    if (fast) {
+        ResultKey key;
+        bool cacheable = result_key(*typed_, fast_update_.inputs.data(), fast_update_.interval, key);
+        auto hit = cacheable ? ResultCache::instance().find(key) : nullptr;
+        if (hit && !fast_update_.has_id) {
+            write_record(frame_payload(hit->frame(framing), framing), running);
+            return true;
+        }
+        json reply;
+        try {
+            reply = hit ? hit->result() : run_fast_update(*typed_, fast_update_);
+        } catch (const std::exception& e) {
+            reply = json{{"error", e.what()}};
+        }
+        if (cacheable && !hit) ResultCache::instance().insert(std::move(key), reply);
+        if (fast_update_.has_id) tag_reply(reply, fast_update_.id);
+        send(reply, framing, running);
+    } else {
+        handle(cmd, framing, running);
+    }
+    return true;
+}
+
+// Requests run one at a time here, so an id is only echoed.
+void ShmServer::handle(const json& cmd, Framing framing, const std::atomic<bool>& running) {
+    json reply;
+    auto id_it = cmd.is_object() ? cmd.find("id") : cmd.end();
+    const json* id = id_it != cmd.end() ? &*id_it : nullptr;
+    if (cmd.is_discarded()) {
+        reply = framing == Framing::Ndjson
+                    ? invalid_json_reply()
+                    : json{{"error", std::string("invalid ") + framing_name(framing)}};
+    } else {
+        Framing next = framing;
+        if (negotiate_framing(cmd, next, reply)) {
+            if (id) tag_reply(reply, *id);
+            // The reply still uses the old framing, as on a socket.
+            staging_.clear();
+            append_payload(staging_, reply, framing);
+            write_record(staging_, running);
+            header_->framing.store(static_cast<uint32_t>(next));
+            return;
+        }
+        if (auto bytes = id ? nullptr : cached_reply(cmd, *process_, framing)) {
+            write_record(frame_payload(*bytes, framing), running);
+            return;
+        }
+        ResultKey key;
+        bool cacheable = update_result_key(cmd, *process_, &session_, key);
+        auto hit = cacheable ? ResultCache::instance().find(key) : nullptr;
+        if (hit && !id) {
+            write_record(frame_payload(hit->frame(framing), framing), running);
+            return;
+        }
+        try {
+            reply = hit ? hit->result() : run_command(cmd, *process_, &session_);
+        } catch (const std::exception& e) {
+            reply = json{{"error", e.what()}};
+        }
+        if (cacheable && !hit) ResultCache::instance().insert(std::move(key), reply);
+    }
+
+    if (session_.stream) {
+        // Nothing else shares this thread, so a stream is simply pumped to
+        // the end; a full ring holds it back.
+        json frame;
+        bool more = true;
+        while (more) {
+            try {
+                more = session_.stream->next(frame);
+            } catch (const std::exception& e) {
+                frame = json{{"error", e.what()}, {"done", true}};
+                more = false;
+            }
+            if (id) tag_reply(frame, *id);
+            staging_.clear();
+            {
+                StageTimer timer(Stage::Serialize);
+                append_payload(staging_, frame, framing);
+            }
+            if (!write_record(staging_, running)) break;
+        }
+        session_.stream.reset();
+        return;
+    }
+    if (id) tag_reply(reply, *id);
+    send(reply, framing, running);
+}
+
+void ShmServer::send(const json& reply, Framing framing, const std::atomic<bool>& running) {
+    staging_.clear();
+    {
+        StageTimer timer(Stage::Serialize);
+        append_payload(staging_, reply, framing);
+    }
+    write_record(staging_, running);
+}
+
+// Copies one record into the reply ring, waiting while it is full.
+// Returns false if the server stops first.
+bool ShmServer::write_record(std::string_view payload, const std::atomic<bool>& running) {
+    if (shm_record_bytes(payload.size()) > ring_bytes_ / 2) {
+        // Could never fit next to a wrap; send a short error instead.
+        staging_.clear();
+        append_payload(staging_, json{{"error", "reply too large for shared memory"}},
+                       static_cast<Framing>(header_->framing.load()));
+        payload = staging_;
+    }
+
+    ShmRing& ring = header_->reply;
+    char* data = reply_data();
+    const size_t need = shm_record_bytes(payload.size());
+
+    while (true) {
+        uint64_t head = ring.head.load(std::memory_order_relaxed);
+        uint64_t tail = ring.tail.load(std::memory_order_acquire);
+        size_t off = static_cast<size_t>(head % ring_bytes_);
+        size_t contiguous = ring_bytes_ - off;
+        size_t total = need <= contiguous ? need : contiguous + need;
+        if (ring_bytes_ - (head - tail) < total) {
+            if (!may_wait(running)) return false;
+            timed_wait(&ring.space);
+            continue;
+        }
+
+        if (need > contiguous) {
+            // contiguous is a multiple of SHM_ALIGN, so the marker fits.
+            std::memcpy(data + off, &SHM_WRAP, sizeof(SHM_WRAP));
+            head += contiguous;
+            off = 0;
+        }
+        uint32_t len = static_cast<uint32_t>(payload.size());
+        std::memcpy(data + off, &len, sizeof(len));
+        std::memcpy(data + off + sizeof(len), payload.data(), payload.size());
+        ring.head.store(head + need, std::memory_order_release);
+        ::sem_post(&ring.data);
+        Metrics::instance().add_bytes_out(payload.size());
+        return true;
+    }
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <semaphore.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "fast_update.hpp"
+#include "framing.hpp"
+#include "process.hpp"
+#include "protocol.hpp"
+#include "reactor.hpp"
+#include "worker_pool.hpp"
+
+// ----------------------- Shared-memory transport -----------------
+// For a client on the same host, requests and replies can skip the
+// socket layer entirely. The server creates a POSIX shared-memory
+// segment (server.shm_name / SHM_NAME) holding two single-producer
+// single-consumer rings:
+//
+//   request ring  written by the client, read by the server
+//   reply ring    written by the server, read by the client
+//
+// Each ring carries records of a 4-byte native-endian length followed by
+// the payload (no newline, no big-endian prefix), padded to 8 bytes. A
+// length of SHM_WRAP means "continue at offset 0". Payloads use the
+// framing from the segment header, which starts as server.protocol and
+// follows protocol commands like a socket connection does.
+//
+// head is advanced only by the producer and tail only by the consumer;
+// both count bytes ever written, so head - tail is the fill level. The
+// semaphores are wake-up hints: after posting `data` or `space` the other
+// side rechecks the indexes, so a missed or extra post costs one timeout
+// at most.
+//
+// The segment serves one client at a time, with its own Process and
+// Session, exactly like a single connection, and drains like one at
+// shutdown.
+
+static const uint32_t SHM_MAGIC = 0x56495653;  // "VIVS"
+static const uint32_t SHM_VERSION = 1;
+static const uint32_t SHM_WRAP = 0xffffffffu;
+static const size_t SHM_ALIGN = 8;
+
+struct alignas(64) ShmRing {
+    alignas(64) std::atomic<uint64_t> head;  // producer
+    alignas(64) std::atomic<uint64_t> tail;  // consumer
+    sem_t data;   // posted after a record is published
+    sem_t space;  // posted after a record is consumed
+};
+
+struct ShmHeader {
+    uint32_t magic;
+    uint32_t version;
+    std::atomic<uint32_t> framing;  // a Framing value
+    uint32_t reserved;
+    uint64_t capacity;  // bytes in each ring's data area, a multiple of SHM_ALIGN
+    ShmRing request;
+    ShmRing reply;
+    // followed by the request data area, then the reply data area
+};
+
+// Maps a record's length to the bytes it takes up in the ring.
+inline size_t shm_record_bytes(size_t len) {
+    return (sizeof(uint32_t) + len + SHM_ALIGN - 1) & ~(SHM_ALIGN - 1);
+}
+
+class ShmServer {
+public:
+    using ProcessFactory = std::function<std::unique_ptr<Process>()>;
+
+    // An empty `checkpoint_dir` disables checkpoint and restore.
+    ShmServer(std::string name, size_t ring_bytes, Framing framing, WorkerPool& pool,
+              ProcessFactory factory, long drain_timeout_ms, std::string checkpoint_dir = "");
+    ~ShmServer();
+
+    ShmServer(const ShmServer&) = delete;
+    ShmServer& operator=(const ShmServer&) = delete;
+
+    // Creates the segment and starts serving it on its own thread.
+    bool start(const std::atomic<bool>& running);
+    // Joins the thread and removes the segment.
+    void stop();
+
+    // What the drain got through, counting the segment as one connection;
+    // valid after stop().
+    const DrainReport& drain_report() const { return drain_report_; }
+
+private:
+    void serve(const std::atomic<bool>& running);
+    bool serve_next(const std::atomic<bool>& running);
+    size_t queued_records(uint64_t tail, uint64_t head) const;
+    // False once the server has stopped and the drain deadline passed.
+    bool may_wait(const std::atomic<bool>& running) const;
+    void handle(const json& cmd, Framing framing, const std::atomic<bool>& running);
+    void send(const json& reply, Framing framing, const std::atomic<bool>& running);
+    bool write_record(std::string_view payload, const std::atomic<bool>& running);
+
+    char* request_data() const;
+    char* reply_data() const;
+
+    std::string name_;
+    size_t ring_bytes_;
+    Framing framing_;
+    WorkerPool& pool_;
+    ProcessFactory factory_;
+    long drain_timeout_ms_;
+    std::string checkpoint_dir_;
+    std::chrono::steady_clock::time_point drain_deadline_{};
+    DrainReport drain_report_;
+
+    ShmHeader* header_ = nullptr;
+    size_t mapped_bytes_ = 0;
+    std::unique_ptr<Process> process_;
+    TypedProcess* typed_ = nullptr;  // process_, if updates can take the fast path
+    FastUpdate fast_update_;
+    Session session_;
+    std::string staging_;  // the reply being serialized
+    std::thread thread_;
+};
@@ -0,0 +1,150 @@
+#include "snapshot.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mapped_file.hpp"
+
+static const char CHECKPOINT_MAGIC[4] = {'V', 'V', 'C', 'K'};
+static const uint32_t CHECKPOINT_VERSION = 1;
+static const char* CHECKPOINT_SUFFIX = ".ckpt";
+
+struct CheckpointHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t ports_hash;      // ports_hash() of the process that wrote it
+    uint64_t process_bytes;   // save_state() image, right after the header
+    uint64_t session_bytes;   // MessagePack session state, after the image
+    uint32_t has_session;     // whether the writer was in delta mode
+    uint32_t reserved;
+};
+
+static std::runtime_error checkpoint_error(const std::string& what, const std::string& path) {
+    return std::runtime_error(what + " " + path + ": " + std::strerror(errno));
+}
+
+// FNV-1a over the port schemas and schema_version(): a checkpoint only
+// loads into a process that reads and writes the same ports.
+static uint64_t ports_hash(const Process& process) {
+    uint64_t hash = 1469598103934665603ull;
+    auto mix = [&hash](std::string_view bytes) {
+        for (unsigned char c : bytes) {
+            hash ^= c;
+            hash *= 1099511628211ull;
+        }
+    };
+    mix(process.inputs().dump());
+    mix(process.outputs().dump());
+    uint64_t version = process.schema_version();
+    mix(std::string_view(reinterpret_cast<const char*>(&version), sizeof(version)));
+    return hash;
+}
+
+static void write_all(int fd, const char* data, std::size_t size, const std::string& path) {
+    while (size > 0) {
+        ssize_t n = ::write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw checkpoint_error("cannot write", path);
+        }
+        data += n;
+        size -= static_cast<std::size_t>(n);
+    }
+}
+
+std::string checkpoint_path(const std::string& dir, const std::string& name) {
+    bool valid = !name.empty() && name.front() != '.' && name.size() <= 200;
+    for (char c : name) {
+        bool plain = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+                     c == '_' || c == '-' || c == '.';
+        if (!plain) valid = false;
+    }
+    if (!valid) {
+        throw std::runtime_error("checkpoint names may only use letters, digits, '_', '-' and '.'");
+    }
+    return dir + "/" + name + CHECKPOINT_SUFFIX;
+}
+
+std::size_t save_checkpoint(const std::string& path, const Process& process,
+                            const Session* session) {
+    std::string image;
+    process.save_state(image);
+    std::vector<uint8_t> session_bytes;
+    bool has_session = session != nullptr && session->has_state;
+    if (has_session) json::to_msgpack(session->state, session_bytes);
+
+    CheckpointHeader header{};
+    std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.ports_hash = ports_hash(process);
+    header.process_bytes = image.size();
+    header.session_bytes = session_bytes.size();
+    header.has_session = has_session ? 1 : 0;
+
+    std::string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) throw checkpoint_error("cannot create", tmp);
+    try {
+        write_all(fd, reinterpret_cast<const char*>(&header), sizeof(header), tmp);
+        write_all(fd, image.data(), image.size(), tmp);
+        write_all(fd, reinterpret_cast<const char*>(session_bytes.data()), session_bytes.size(), tmp);
+        if (::fsync(fd) != 0) throw checkpoint_error("cannot flush", tmp);
+    } catch (...) {
+        ::close(fd);
+        ::unlink(tmp.c_str());
+        throw;
+    }
+    ::close(fd);
+    if (::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::runtime_error error = checkpoint_error("cannot rename", tmp);
+        ::unlink(tmp.c_str());
+        throw error;
+    }
+    return sizeof(header) + image.size() + session_bytes.size();
+}
+
+std::size_t load_checkpoint(const std::string& path, Process& process, Session* session) {
+    MappedFile file(path);
+    CheckpointHeader header{};
+    if (file.size() < sizeof(header)) {
+        throw std::runtime_error("not a checkpoint: " + path);
+    }
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0) {
+        throw std::runtime_error("not a checkpoint: " + path);
+    }
+    if (header.version != CHECKPOINT_VERSION) {
+        throw std::runtime_error("unsupported checkpoint version " + std::to_string(header.version) +
+                                 ": " + path);
+    }
+    std::size_t body = file.size() - sizeof(header);
+    if (header.process_bytes > body || header.session_bytes != body - header.process_bytes) {
+        throw std::runtime_error("truncated checkpoint: " + path);
+    }
+    if (header.ports_hash != ports_hash(process)) {
+        throw std::runtime_error("checkpoint was written by a process with other ports: " + path);
+    }
+
+    const char* image = file.data() + sizeof(header);
+    json state;
+    if (session != nullptr && header.has_session) {
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(image + header.process_bytes);
+        state = json::from_msgpack(bytes, bytes + header.session_bytes, /*strict=*/true,
+                                   /*allow_exceptions=*/false);
+        if (state.is_discarded()) throw std::runtime_error("corrupt checkpoint session: " + path);
+    }
+
+    process.load_state(std::string_view(image, header.process_bytes));
+    if (session != nullptr) {
+        session->has_state = header.has_session != 0;
+        session->state = header.has_session ? std::move(state) : json::object();
+    }
+    return file.size();
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "process.hpp"
+#include "protocol.hpp"
+
+// ----------------------- Checkpoints -----------------------------
+// A checkpoint is one file holding a binary snapshot of a process:
+//
+//   header   magic "VVCK", format version, a hash of the process's
+//            ports and its schema_version(), and the section sizes
+//   process  the bytes of Process::save_state()
+//   session  the connection's delta-mode state as MessagePack, if any
+//
+// Files are written to a temporary name, flushed and renamed, so a
+// reader never sees half a checkpoint. Loading maps the file read-only
+// and hands the process section to load_state() in place; nothing is
+// copied. Byte order is the host's: checkpoints move between runs and
+// builds on one machine, not between architectures.
+
+// `dir`/`name`.ckpt. Throws std::runtime_error unless `name` is a plain
+// file name: letters, digits, '_', '-' and '.', not starting with '.'.
+std::string checkpoint_path(const std::string& dir, const std::string& name);
+
+// Writes `process` (and `session`'s delta state, when given) to `path`.
+// Returns the size of the file. Throws std::runtime_error on failure.
+std::size_t save_checkpoint(const std::string& path, const Process& process,
+                            const Session* session);
+
+// Restores `process` (and `session`, when given) from `path`. Returns
+// the size of the file. Throws std::runtime_error if the file is
+// missing, truncated, or was written by a process with other ports;
+// `process` is only touched once the file checks out.
+std::size_t load_checkpoint(const std::string& path, Process& process, Session* session);
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+#include "batch_process.hpp"
+#include "run.hpp"
+
+// ----------------------- Static ports ----------------------------
+// Ports declared at compile time. A port is a type with a name, a
+// numeric type, a default and (for outputs) an _apply rule:
+//
+//   struct Counter : NumberPort {
+//       static constexpr const char* name = "counter";
+//       static constexpr Apply apply = Apply::Set;
+//   };
+//
+// and Ports<A, B, ...> lists ports in slot order. Everything the server
+// needs from a schema (the JSON it reports, the slot layout, the slot
+// of a key) is generated from those types instead of interpreting a
+// runtime schema.
+
+enum class PortType { Number, Integer, Float };
+
+inline const char* port_type_name(PortType type) {
+    switch (type) {
+    case PortType::Integer: return "integer";
+    case PortType::Float:   return "float";
+    case PortType::Number:  break;
+    }
+    return "number";
+}
+
+inline const char* apply_name(Apply apply) {
+    switch (apply) {
+    case Apply::Set:        return "set";
+    case Apply::Merge:      return "merge";
+    case Apply::Nothing:    return "null";
+    case Apply::Accumulate: break;
+    }
+    return "accumulate";
+}
+
+// Defaults for a port; derive and shadow what differs.
+struct NumberPort {
+    static constexpr PortType type = PortType::Number;
+    static constexpr double default_value = 0.0;
+    static constexpr Apply apply = Apply::Accumulate;  // used for outputs only
+};
+
+template <class... P>
+struct Ports {
+    static constexpr std::size_t size = sizeof...(P);
+
+    // Slot of `Port`, or `size` if it is not in the list.
+    template <class Port>
+    static constexpr std::size_t index() {
+        constexpr bool match[] = {std::is_same<Port, P>::value..., false};
+        for (std::size_t i = 0; i < size; ++i) {
+            if (match[i]) return i;
+        }
+        return size;
+    }
+
+    // The typed state: one double per port, addressed by port type.
+    struct Values {
+        double slots[size > 0 ? size : 1] = {};
+
+        template <class Port>
+        double& get() {
+            static_assert(index<Port>() < size, "port is not in this list");
+            return slots[index<Port>()];
+        }
+        template <class Port>
+        double get() const {
+            static_assert(index<Port>() < size, "port is not in this list");
+            return slots[index<Port>()];
+        }
+    };
+
+    // Compares against each name in turn; short lists beat a hash lookup.
+    static int slot(const std::string& name) {
+        int found = -1;
+        int i = 0;
+        ((found < 0 && name == P::name ? found = i : 0, ++i), ...);
+        return found;
+    }
+
+    static json schema(bool outputs) {
+        json schema = json::object();
+        (add_port<P>(schema, outputs), ...);
+        return schema;
+    }
+
+    static StateLayout layout() {
+        StateLayout layout;
+        (layout.add(P::name, P::default_value), ...);
+        return layout;
+    }
+
+private:
+    template <class Port>
+    static void add_port(json& schema, bool outputs) {
+        json port = json{{"_type", port_type_name(Port::type)}};
+        if (Port::default_value != 0.0) port["_default"] = Port::default_value;
+        if (outputs) port["_apply"] = apply_name(Port::apply);
+        schema[Port::name] = std::move(port);
+    }
+};
+
+// ----------------------- Static process --------------------------
+// Base for a process whose ports are Ports<> lists. `Derived` implements
+//
+//   void step(const Inputs& in, Outputs& out, double interval);
+//
+// reading and writing ports as in.get<Port>(); the slot indices are
+// constants, so step() compiles to plain loads and stores. update_typed
+// and update_columns are generated around it, and either can still be
+// overridden with a hand-written kernel.
+
+template <class Derived, class In, class Out>
+class StaticProcess : public BatchProcess {
+public:
+    using InPorts = In;
+    using OutPorts = Out;
+    using Inputs = typename In::Values;
+    using Outputs = typename Out::Values;
+
+    StaticProcess() : BatchProcess(In::layout(), Out::layout()) {}
+
+    json inputs() const final {
+        static const json schema = In::schema(/*outputs=*/false);
+        return schema;
+    }
+    json outputs() const final {
+        static const json schema = Out::schema(/*outputs=*/true);
+        return schema;
+    }
+
+    int input_slot(const std::string& name) const final { return In::slot(name); }
+
+    void update_typed(const double* in, double* out, double interval) override {
+        Inputs inputs;
+        Outputs outputs;
+        std::memcpy(inputs.slots, in, In::size * sizeof(double));
+        derived().step(inputs, outputs, interval);
+        std::memcpy(out, outputs.slots, Out::size * sizeof(double));
+    }
+
+    void update_columns(const BatchColumns& batch) override {
+        for (std::size_t row = 0; row < batch.rows; ++row) {
+            Inputs inputs;
+            Outputs outputs;
+            for (std::size_t s = 0; s < In::size; ++s) inputs.slots[s] = batch.in[s][row];
+            derived().step(inputs, outputs, batch.intervals[row]);
+            for (std::size_t s = 0; s < Out::size; ++s) batch.out[s][row] = outputs.slots[s];
+        }
+    }
+
+private:
+    Derived& derived() { return static_cast<Derived&>(*this); }
+};
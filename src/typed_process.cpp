@@ -0,0 +1,94 @@
+#include "typed_process.hpp"
+
+static bool is_numeric_type(const json& port) {
+    if (!port.is_object()) return false;
+    auto it = port.find("_type");
+    if (it == port.end() || !it->is_string()) return false;
+    const std::string& t = it->get_ref<const std::string&>();
+    return t == "number" || t == "float" || t == "integer";
+}
+
+StateLayout StateLayout::compile(const json& schema) {
+    StateLayout layout;
+    if (!schema.is_object()) return layout;
+    for (auto it = schema.begin(); it != schema.end(); ++it) {
+        if (!is_numeric_type(it.value())) continue;
+        double def = 0.0;
+        auto d = it.value().find("_default");
+        if (d != it.value().end() && d->is_number()) def = d->get<double>();
+        layout.add(it.key(), def);
+    }
+    return layout;
+}
+
+void StateLayout::add(const std::string& name, double default_value) {
+    index_[name] = static_cast<int>(names.size());
+    names.push_back(name);
+    defaults.push_back(default_value);
+}
+
+int StateLayout::slot(const std::string& name) const {
+    auto it = index_.find(name);
+    return it == index_.end() ? -1 : it->second;
+}
+
+TypedProcess::TypedProcess(const TypedProcess& other) : Process(other) {
+    other.layouts();
+    layouts_ = other.layouts_;
+    std::call_once(compiled_, [] {});
+}
+
+TypedProcess::TypedProcess(StateLayout inputs, StateLayout outputs) {
+    auto l = std::make_shared<Layouts>();
+    l->inputs = std::move(inputs);
+    l->outputs = std::move(outputs);
+    layouts_ = std::move(l);
+    std::call_once(compiled_, [] {});
+}
+
+const TypedProcess::Layouts& TypedProcess::layouts() const {
+    std::call_once(compiled_, [this] {
+        auto l = std::make_shared<Layouts>();
+        l->inputs = StateLayout::compile(inputs());
+        l->outputs = StateLayout::compile(outputs());
+        layouts_ = std::move(l);
+    });
+    return *layouts_;
+}
+
+void TypedProcess::read_inputs(const json& state, double* in) const {
+    const StateLayout& layout = input_layout();
+    for (std::size_t i = 0; i < layout.size(); ++i) {
+        in[i] = layout.defaults[i];
+    }
+    if (!state.is_object()) return;
+    for (std::size_t i = 0; i < layout.size(); ++i) {
+        auto it = state.find(layout.names[i]);
+        if (it != state.end() && it->is_number()) in[i] = it->get<double>();
+    }
+}
+
+json TypedProcess::write_outputs(const double* out) const {
+    const StateLayout& layout = output_layout();
+    json result = json::object();
+    for (std::size_t i = 0; i < layout.size(); ++i) {
+        result[layout.names[i]] = out[i];
+    }
+    return result;
+}
+
+// Scratch slots are reused per thread so steady-state updates do not
+// allocate for the typed part.
+json TypedProcess::update(const json& state, double interval) {
+    thread_local std::vector<double> in;
+    in.resize(input_layout().size());
+    read_inputs(state, in.data());
+    return update_inputs(in.data(), interval);
+}
+
+json TypedProcess::update_inputs(const double* in, double interval) {
+    thread_local std::vector<double> out;
+    out.assign(output_layout().size(), 0.0);
+    update_typed(in, out.data(), interval);
+    return write_outputs(out.data());
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "process.hpp"
+
+// ----------------------- Typed state layout ----------------------
+// A flat table of double slots compiled from an inputs()/outputs()
+// schema. Every port whose _type is numeric ("number", "float",
+// "integer") gets a slot, in the schema's key order; other ports are
+// left out and never reach a TypedProcess.
+
+struct StateLayout {
+    std::vector<std::string> names;   // slot i holds port names[i]
+    std::vector<double> defaults;     // from "_default", else 0.0
+
+    static StateLayout compile(const json& schema);
+    void add(const std::string& name, double default_value);
+
+    std::size_t size() const { return names.size(); }
+    // Slot index of `name`, or -1 if it has none.
+    int slot(const std::string& name) const;
+
+private:
+    std::unordered_map<std::string, int> index_;
+};
+
+// ----------------------- Typed process ---------------------------
+// Alternative base for processes whose ports are all numbers. The
+// schemas are compiled into StateLayouts once; update_typed() then reads
+// and writes plain double slots, and JSON is only touched when the
+// server-facing update() marshals a request in and the result out.
+
+class TypedProcess : public Process {
+public:
+    TypedProcess() = default;
+    // Copies share the source's compiled layouts.
+    TypedProcess(const TypedProcess& other);
+    TypedProcess& operator=(const TypedProcess&) = delete;
+
+    // `in` holds one value per input slot, `out` one per output slot; all
+    // output slots are returned to the client.
+    virtual void update_typed(const double* in, double* out, double interval) = 0;
+
+    json update(const json& state, double interval) final;
+    // update() with the input slots already filled, as by the fast
+    // update path (fast_update.hpp).
+    json update_inputs(const double* in, double interval);
+
+    const StateLayout& input_layout() const { return layouts().inputs; }
+    const StateLayout& output_layout() const { return layouts().outputs; }
+
+    // Slot of an input port by name, or -1; used by the fast update
+    // parser for every key of a state.
+    virtual int input_slot(const std::string& name) const { return input_layout().slot(name); }
+
+    // Fills `in` from a JSON state: missing or non-numeric ports take the
+    // slot default.
+    void read_inputs(const json& state, double* in) const;
+    json write_outputs(const double* out) const;
+
+protected:
+    // For processes that know their layouts without compiling a schema
+    // (static_process.hpp).
+    TypedProcess(StateLayout inputs, StateLayout outputs);
+
+private:
+    struct Layouts {
+        StateLayout inputs;
+        StateLayout outputs;
+    };
+    const Layouts& layouts() const;
+
+    mutable std::once_flag compiled_;
+    mutable std::shared_ptr<const Layouts> layouts_;
+};
@@ -0,0 +1,113 @@
+#include "worker_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <iostream>
+
+#include "cancel.hpp"
+
+WorkerPool::WorkerPool(std::size_t threads) {
+    if (threads == 0) threads = 1;
+    threads_.reserve(threads);
+    for (std::size_t i = 0; i < threads; ++i) {
+        threads_.emplace_back([this] { run(); });
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    shutdown();
+}
+
+void WorkerPool::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    for (auto& t : threads_) {
+        if (t.joinable()) t.join();
+    }
+}
+
+void WorkerPool::submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        tasks_.push_back(std::move(task));
+    }
+    cv_.notify_one();
+}
+
+std::size_t WorkerPool::queued() {
+    std::lock_guard<std::mutex> lock(mu_);
+    return tasks_.size();
+}
+
+void WorkerPool::run() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mu_);
+            cv_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+            if (tasks_.empty()) return;  // stopping and drained
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        try {
+            task();
+        } catch (const std::exception& e) {
+            std::cerr << "worker task failed: " << e.what() << "\n";
+        } catch (...) {
+            std::cerr << "worker task failed\n";
+        }
+    }
+}
+
+void WorkerPool::parallel_for(std::size_t n, std::size_t grain,
+                              const std::function<void(std::size_t, std::size_t)>& body) {
+    if (n == 0) return;
+    if (grain == 0) grain = 1;
+    std::size_t chunks = (n + grain - 1) / grain;
+    if (chunks == 1 || threads_.size() < 2) {
+        body(0, n);
+        return;
+    }
+
+    // Helpers may start after all chunks are claimed, so the shared state
+    // outlives this call; `body` is only touched while a chunk is held.
+    struct State {
+        std::atomic<std::size_t> next{0};
+        std::size_t done = 0;
+        std::exception_ptr error;
+        std::mutex mu;
+        std::condition_variable cv;
+    };
+    auto st = std::make_shared<State>();
+    const auto* fn = &body;
+    const CancelToken* token = current_cancel_token();
+
+    auto work = [st, fn, n, grain, chunks, token] {
+        CancelScope scope(token);  // helpers see the caller's request as theirs
+        std::size_t c;
+        while ((c = st->next.fetch_add(1)) < chunks) {
+            std::exception_ptr err;
+            try {
+                (*fn)(c * grain, std::min(n, (c + 1) * grain));
+            } catch (...) {
+                err = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(st->mu);
+            if (err && !st->error) st->error = err;
+            if (++st->done == chunks) st->cv.notify_all();
+        }
+    };
+
+    std::size_t helpers = std::min(chunks, threads_.size()) - 1;
+    for (std::size_t i = 0; i < helpers; ++i) submit(work);
+    work();
+
+    std::unique_lock<std::mutex> lock(st->mu);
+    st->cv.wait(lock, [&] { return st->done == chunks; });
+    if (st->error) std::rethrow_exception(st->error);
+}
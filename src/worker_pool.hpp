@@ -0,0 +1,45 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// ----------------------- Worker pool -----------------------------
+// Fixed number of threads draining a FIFO of tasks. shutdown(), also
+// run by the destructor, finishes queued tasks and joins every thread.
+
+class WorkerPool {
+public:
+    explicit WorkerPool(std::size_t threads);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    void submit(std::function<void()> task);
+    void shutdown();
+
+    // Calls body(begin, end) over [0, n) in chunks of about `grain`
+    // items, spread over the pool. The calling thread works on chunks
+    // too, so this is safe to call from inside a pool task. Returns once
+    // every chunk is done; the first exception thrown is rethrown here.
+    // Chunks run under the caller's cancellation token (cancel.hpp).
+    void parallel_for(std::size_t n, std::size_t grain,
+                      const std::function<void(std::size_t, std::size_t)>& body);
+    std::size_t size() const { return threads_.size(); }
+    // Tasks submitted and not yet picked up by a thread.
+    std::size_t queued();
+
+private:
+    void run();
+
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::deque<std::function<void()>> tasks_;
+    bool stopping_ = false;
+    std::vector<std::thread> threads_;
+};